@@ -0,0 +1,233 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * The userland daemon to talk to the kernel and process the target apps
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * event_log.c
+ *
+ * Binary log of the received events so a session can be replayed later
+ *
+ * The file starts with a header followed by length prefixed records:
+ * uint32_t length, uint64_t receive timestamp, struct hydra_event
+ * Timestamps are mach_absolute_time() values in the timebase stored in the header
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mach/mach_time.h>
+
+#define EVENT_LOG_MAGIC     "HYDRALOG"
+#define EVENT_LOG_VERSION   1
+#define EVENT_LOG_BUFFER    (64 * 1024)
+
+struct event_log_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t event_size;
+    uint32_t timebase_numer;
+    uint32_t timebase_denom;
+};
+
+// bytes after the length field of each record
+#define EVENT_LOG_RECORD_LENGTH (sizeof(uint64_t) + sizeof(struct hydra_event))
+
+static FILE *g_log;
+static char *g_log_buffer;
+
+/*
+ * open or create the log, new records are appended
+ */
+int
+event_log_open(const char *path)
+{
+    g_log = fopen(path, "a+b");
+    if (g_log == NULL)
+    {
+        perror("fopen event log");
+        return -1;
+    }
+    // writes only hit the disk every EVENT_LOG_BUFFER bytes
+    g_log_buffer = malloc(EVENT_LOG_BUFFER);
+    if (g_log_buffer != NULL)
+    {
+        setvbuf(g_log, g_log_buffer, _IOFBF, EVENT_LOG_BUFFER);
+    }
+    fseek(g_log, 0, SEEK_END);
+    if (ftell(g_log) == 0)
+    {
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        struct event_log_header header = { 0 };
+        memcpy(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic));
+        header.version = EVENT_LOG_VERSION;
+        header.event_size = sizeof(struct hydra_event);
+        header.timebase_numer = timebase.numer;
+        header.timebase_denom = timebase.denom;
+        fwrite(&header, sizeof(struct event_log_header), 1, g_log);
+    }
+    return 0;
+}
+
+void
+event_log_write(const struct hydra_event *event, uint64_t receive_timestamp)
+{
+    if (g_log == NULL)
+    {
+        return;
+    }
+    // three small writes into the stdio buffer, no padding ends up in the file
+    uint32_t length = EVENT_LOG_RECORD_LENGTH;
+    fwrite(&length, sizeof(length), 1, g_log);
+    fwrite(&receive_timestamp, sizeof(receive_timestamp), 1, g_log);
+    fwrite(event, sizeof(struct hydra_event), 1, g_log);
+}
+
+void
+event_log_flush(void)
+{
+    if (g_log != NULL)
+    {
+        fflush(g_log);
+    }
+}
+
+void
+event_log_close(void)
+{
+    if (g_log != NULL)
+    {
+        fclose(g_log);
+        g_log = NULL;
+    }
+    free(g_log_buffer);
+    g_log_buffer = NULL;
+}
+
+/*
+ * feed a log to dispatch keeping the original spacing between events divided by speed, 0 means as fast as possible
+ * the event timestamps are moved to the present so the latencies measured by dispatch stay meaningful
+ * returns the number of events replayed or -1 if the log can't be read
+ */
+int
+event_log_replay(const char *path, double speed, event_dispatch_t dispatch)
+{
+    FILE *log = fopen(path, "rb");
+    if (log == NULL)
+    {
+        perror("fopen event log");
+        return -1;
+    }
+    setvbuf(log, NULL, _IOFBF, EVENT_LOG_BUFFER);
+    struct event_log_header header;
+    if (fread(&header, sizeof(struct event_log_header), 1, log) != 1 ||
+        memcmp(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != EVENT_LOG_VERSION || header.timebase_denom == 0)
+    {
+        fprintf(stderr, "[ERROR] %s is not an event log\n", path);
+        fclose(log);
+        return -1;
+    }
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    
+    int count = 0;
+    uint64_t first_receive = 0;
+    uint64_t replay_start = mach_absolute_time();
+    uint32_t length = 0;
+    while (fread(&length, sizeof(length), 1, log) == 1)
+    {
+        uint64_t receive_timestamp = 0;
+        struct hydra_event event = { 0 };
+        // records from a different event layout are truncated or zero extended
+        size_t available = (length < EVENT_LOG_RECORD_LENGTH) ? length : EVENT_LOG_RECORD_LENGTH;
+        if (available < sizeof(receive_timestamp) ||
+            fread(&receive_timestamp, sizeof(receive_timestamp), 1, log) != 1 ||
+            (available > sizeof(receive_timestamp) && fread(&event, available - sizeof(receive_timestamp), 1, log) != 1) ||
+            (length > available && fseek(log, length - available, SEEK_CUR) != 0))
+        {
+            fprintf(stderr, "[ERROR] Truncated record after %d events\n", count);
+            break;
+        }
+        if (count == 0)
+        {
+            first_receive = receive_timestamp;
+        }
+        // offset from the first event in nanoseconds, as recorded
+        uint64_t offset = (receive_timestamp - first_receive) * header.timebase_numer / header.timebase_denom;
+        if (speed > 0)
+        {
+            uint64_t due = (uint64_t)(offset / speed);
+            uint64_t elapsed = (mach_absolute_time() - replay_start) * timebase.numer / timebase.denom;
+            if (due > elapsed)
+            {
+                struct timespec ts = { (time_t)((due - elapsed) / 1000000000ULL), (long)((due - elapsed) % 1000000000ULL) };
+                nanosleep(&ts, NULL);
+            }
+        }
+        uint64_t now = mach_absolute_time();
+        uint64_t shift = now - receive_timestamp;
+        event.exec_timestamp += shift;
+        if (event.suspend_timestamp)
+        {
+            event.suspend_timestamp += shift;
+        }
+        event.enqueue_timestamp += shift;
+        dispatch(&event, now);
+        count++;
+    }
+    fclose(log);
+    return count;
+}
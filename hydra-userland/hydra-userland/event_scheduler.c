@@ -0,0 +1,270 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * The userland daemon to talk to the kernel and process the target apps
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * event_scheduler.c
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event_scheduler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <mach/mach_time.h>
+
+#include "metrics.h"
+
+#define MAX_WORKERS     16
+
+/*
+ * how long an event of each class may wait before it's overdue, in milliseconds
+ * overdue events go first, oldest deadline first, so batch work ages to the front instead of starving
+ */
+static const uint64_t g_class_budget[PRIORITY_CLASSES] = {
+    [PRIORITY_NORMAL]       = 200,
+    [PRIORITY_INTERACTIVE]  = 20,
+    [PRIORITY_BATCH]        = 2000,
+};
+
+// order in which the queues are served while nothing is overdue
+static const uint32_t g_class_order[PRIORITY_CLASSES] = { PRIORITY_INTERACTIVE, PRIORITY_NORMAL, PRIORITY_BATCH };
+
+struct queued_event
+{
+    struct hydra_event event;
+    uint64_t receive_timestamp;
+    uint64_t deadline;              // mach_absolute_time()
+    struct queued_event *next;
+};
+
+// one FIFO per class, the head always has the earliest deadline of its class
+struct event_queue
+{
+    struct queued_event *head;
+    struct queued_event *tail;
+};
+
+static struct event_queue g_queues[PRIORITY_CLASSES];
+static uint64_t g_class_budget_abs[PRIORITY_CLASSES];
+static uint32_t g_queued;
+static int g_stopping;
+static int g_workers;
+static pthread_t g_threads[MAX_WORKERS];
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_wakeup = PTHREAD_COND_INITIALIZER;
+static event_handler_t g_handler;
+
+static void *worker(void *arg);
+static struct queued_event *pick_event(uint64_t now);
+
+/*
+ * start the worker threads, events submitted after this are handled by them
+ */
+int
+event_scheduler_start(int workers, event_handler_t handler)
+{
+    if (workers < 1 || workers > MAX_WORKERS)
+    {
+        fprintf(stderr, "[ERROR] Number of workers must be between 1 and %d\n", MAX_WORKERS);
+        return -1;
+    }
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    for (int i = 0; i < PRIORITY_CLASSES; i++)
+    {
+        g_class_budget_abs[i] = g_class_budget[i] * 1000000ULL * timebase.denom / timebase.numer;
+    }
+    g_handler = handler;
+    for (g_workers = 0; g_workers < workers; g_workers++)
+    {
+        if (pthread_create(&g_threads[g_workers], NULL, worker, NULL))
+        {
+            perror("pthread_create");
+            event_scheduler_stop();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+event_scheduler_running(void)
+{
+    return g_workers > 0;
+}
+
+/*
+ * queue the event in its class, an unknown class is treated as normal
+ */
+void
+event_scheduler_submit(const struct hydra_event *event, uint64_t receive_timestamp)
+{
+    struct queued_event *entry = malloc(sizeof(struct queued_event));
+    if (entry == NULL)
+    {
+        // better late than never, handle it here
+        perror("malloc");
+        g_handler((struct hydra_event*)event, receive_timestamp);
+        return;
+    }
+    uint32_t class = (event->priority < PRIORITY_CLASSES) ? event->priority : PRIORITY_NORMAL;
+    entry->event = *event;
+    entry->receive_timestamp = receive_timestamp;
+    entry->deadline = receive_timestamp + g_class_budget_abs[class];
+    entry->next = NULL;
+    pthread_mutex_lock(&g_lock);
+    struct event_queue *queue = &g_queues[class];
+    if (queue->tail != NULL)
+    {
+        queue->tail->next = entry;
+    }
+    else
+    {
+        queue->head = entry;
+    }
+    queue->tail = entry;
+    g_queued++;
+    pthread_cond_signal(&g_wakeup);
+    pthread_mutex_unlock(&g_lock);
+}
+
+/*
+ * events waiting for a worker
+ */
+uint32_t
+event_scheduler_depth(void)
+{
+    return g_queued;
+}
+
+/*
+ * the workers finish everything already queued and exit
+ */
+void
+event_scheduler_stop(void)
+{
+    pthread_mutex_lock(&g_lock);
+    g_stopping = 1;
+    pthread_cond_broadcast(&g_wakeup);
+    pthread_mutex_unlock(&g_lock);
+    for (int i = 0; i < g_workers; i++)
+    {
+        pthread_join(g_threads[i], NULL);
+    }
+    g_workers = 0;
+}
+
+#pragma mark Local functions
+
+static void *
+worker(void *arg)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&g_lock);
+        while (g_queued == 0 && !g_stopping)
+        {
+            pthread_cond_wait(&g_wakeup, &g_lock);
+        }
+        if (g_queued == 0)
+        {
+            pthread_mutex_unlock(&g_lock);
+            break;
+        }
+        uint64_t start = mach_absolute_time();
+        struct queued_event *entry = pick_event(start);
+        g_queued--;
+        pthread_mutex_unlock(&g_lock);
+        if (start > entry->deadline)
+        {
+            metrics_deadline_missed();
+        }
+        g_handler(&entry->event, entry->receive_timestamp);
+        metrics_worker_busy(start, mach_absolute_time());
+        free(entry);
+    }
+    return NULL;
+}
+
+/*
+ * called locked with at least one event queued
+ * the overdue head with the earliest deadline if there's one, else the head of the most urgent class
+ */
+static struct queued_event *
+pick_event(uint64_t now)
+{
+    int chosen = -1;
+    for (int i = 0; i < PRIORITY_CLASSES; i++)
+    {
+        struct queued_event *head = g_queues[i].head;
+        if (head != NULL && head->deadline <= now && (chosen < 0 || head->deadline < g_queues[chosen].head->deadline))
+        {
+            chosen = i;
+        }
+    }
+    for (int i = 0; chosen < 0 && i < PRIORITY_CLASSES; i++)
+    {
+        if (g_queues[g_class_order[i]].head != NULL)
+        {
+            chosen = g_class_order[i];
+        }
+    }
+    struct event_queue *queue = &g_queues[chosen];
+    struct queued_event *entry = queue->head;
+    queue->head = entry->next;
+    if (queue->head == NULL)
+    {
+        queue->tail = NULL;
+    }
+    return entry;
+}
@@ -0,0 +1,214 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * The userland daemon to talk to the kernel and process the target apps
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * latency_stats.c
+ *
+ * Per target latency histograms for the daemon side of the timeline
+ * The kernel stamps exec, suspend and enqueue times into each event, we add
+ * the receive and resume times and print p50/p99/max for each target
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "latency_stats.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/kern_control.h>
+#include <sys/sys_domain.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <mach/mach_time.h>
+
+#include "latency_histogram.h"
+
+// targets we keep track of, anything above this is ignored
+#define MAX_TRACKED_TARGETS     64
+// number of kernel entries we ask for in print_kernel_latency()
+#define MAX_KERNEL_STATS        64
+
+struct target_latency
+{
+    char name[MAXCOMLEN+1];
+    struct latency_histogram exec_to_receive;   // kernel notification plus daemon pickup
+    struct latency_histogram exec_to_resume;    // total time the process was frozen
+};
+
+static struct target_latency g_target_latency[MAX_TRACKED_TARGETS];
+static uint32_t g_tracked_targets;
+// taken to add a target, the histograms themselves are updated atomically
+static pthread_mutex_t g_tracked_lock = PTHREAD_MUTEX_INITIALIZER;
+static mach_timebase_info_data_t g_timebase;
+
+static struct target_latency * find_target_latency(const char *name);
+static uint64_t elapsed_nanoseconds(uint64_t start, uint64_t end);
+static void print_histogram(FILE *out, const char *name, const char *stage, const struct latency_histogram *histogram);
+
+/*
+ * called after each target is resumed
+ */
+void
+record_event_latency(const struct hydra_event *event, uint64_t receive_timestamp, uint64_t resume_timestamp)
+{
+    struct target_latency *target = find_target_latency(event->name);
+    if (target == NULL)
+    {
+        return;
+    }
+    latency_histogram_record(&target->exec_to_receive, elapsed_nanoseconds(event->exec_timestamp, receive_timestamp));
+    latency_histogram_record(&target->exec_to_resume, elapsed_nanoseconds(event->exec_timestamp, resume_timestamp));
+}
+
+/*
+ * dump the histograms we collected
+ */
+void
+print_daemon_latency(FILE *out)
+{
+    fprintf(out, "[INFO] Daemon side latencies (usec):\n");
+    fprintf(out, "%-17s %-16s %10s %10s %10s %10s\n", "target", "stage", "count", "p50", "p99", "max");
+    for (uint32_t i = 0; i < g_tracked_targets; i++)
+    {
+        print_histogram(out, g_target_latency[i].name, "exec->receive", &g_target_latency[i].exec_to_receive);
+        print_histogram(out, g_target_latency[i].name, "exec->resume", &g_target_latency[i].exec_to_resume);
+    }
+}
+
+/*
+ * retrieve and dump the histograms collected by the kernel extension
+ */
+int
+print_kernel_latency(int socket, FILE *out)
+{
+    socklen_t len = MAX_KERNEL_STATS * sizeof(struct hydra_latency_stats);
+    struct hydra_latency_stats *stats = calloc(MAX_KERNEL_STATS, sizeof(struct hydra_latency_stats));
+    if (stats == NULL)
+    {
+        return -1;
+    }
+    if (getsockopt(socket, SYSPROTO_CONTROL, GET_LATENCY_STATS, stats, &len))
+    {
+        perror("getsockopt GET_LATENCY_STATS");
+        free(stats);
+        return -1;
+    }
+    fprintf(out, "[INFO] Kernel side latencies (usec):\n");
+    fprintf(out, "%-17s %-16s %10s %10s %10s %10s\n", "target", "stage", "count", "p50", "p99", "max");
+    for (size_t i = 0; i < len / sizeof(struct hydra_latency_stats); i++)
+    {
+        print_histogram(out, stats[i].name, "exec->suspend", &stats[i].exec_to_suspend);
+        print_histogram(out, stats[i].name, "exec->enqueue", &stats[i].exec_to_enqueue);
+    }
+    free(stats);
+    return 0;
+}
+
+#pragma mark Local functions
+
+static struct target_latency *
+find_target_latency(const char *name)
+{
+    for (uint32_t i = 0; i < g_tracked_targets; i++)
+    {
+        if (strncmp(g_target_latency[i].name, name, MAXCOMLEN) == 0)
+        {
+            return &g_target_latency[i];
+        }
+    }
+    // another worker may have added it while we were looking
+    pthread_mutex_lock(&g_tracked_lock);
+    struct target_latency *new_target = NULL;
+    for (uint32_t i = 0; i < g_tracked_targets; i++)
+    {
+        if (strncmp(g_target_latency[i].name, name, MAXCOMLEN) == 0)
+        {
+            new_target = &g_target_latency[i];
+        }
+    }
+    if (new_target == NULL && g_tracked_targets < MAX_TRACKED_TARGETS)
+    {
+        new_target = &g_target_latency[g_tracked_targets];
+        strlcpy(new_target->name, name, sizeof(new_target->name));
+        // published after the name is there, readers don't take the lock
+        __sync_synchronize();
+        g_tracked_targets++;
+    }
+    pthread_mutex_unlock(&g_tracked_lock);
+    return new_target;
+}
+
+/*
+ * the kernel and userland share the same mach_absolute_time() timebase
+ */
+static uint64_t
+elapsed_nanoseconds(uint64_t start, uint64_t end)
+{
+    if (g_timebase.denom == 0)
+    {
+        mach_timebase_info(&g_timebase);
+    }
+    if (end < start)
+    {
+        return 0;
+    }
+    return (end - start) * g_timebase.numer / g_timebase.denom;
+}
+
+static void
+print_histogram(FILE *out, const char *name, const char *stage, const struct latency_histogram *histogram)
+{
+    fprintf(out, "%-17s %-16s %10llu %10llu %10llu %10llu\n", name, stage,
+            histogram->count,
+            latency_histogram_percentile(histogram, 500) / 1000,
+            latency_histogram_percentile(histogram, 990) / 1000,
+            histogram->max / 1000);
+}
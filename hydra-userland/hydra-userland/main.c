@@ -62,27 +62,595 @@
 #include <sys/kern_control.h>
 #include <sys/kern_event.h>
 #include <sys/sys_domain.h>
+#include <sys/event.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <signal.h>
+#include <sys/mman.h>
 
 #include <mach/mach.h>
 #include <mach/mach_types.h>
 #include <mach/i386/thread_status.h>
 #include <mach/mach_vm.h>
+#include <mach/mach_time.h>
 
 #include "shared_data.h"
+#include "event_ring.h"
+#include "latency_stats.h"
+#include "task_cache.h"
+#include "event_log.h"
+#include "target_config.h"
+#include "metrics.h"
+#include "event_scheduler.h"
 
 static int g_socket = -1;
+static int g_monitor = 0;
+static volatile sig_atomic_t g_dump_stats = 0;
+static volatile sig_atomic_t g_reload = 0;
+static const char *g_config_path = NULL;
+// what we last sent to the kernel
+static struct target_set g_targets;
+static uint64_t g_table_generation = TABLE_GENERATION_UNKNOWN;
+static int g_use_ring = 0;
+static int g_replay = 0;
+static uint32_t g_verdict_ttl = 0;
+static struct hydra_degrade_config g_degrade = { 0 };
+static struct hydra_batch_config g_batch = { 0 };
+static int g_workers = 1;
+static struct event_ring g_ring;
+
+static void
+dump_stats_handler(int signal)
+{
+    g_dump_stats = 1;
+}
+
+static void
+reload_handler(int signal)
+{
+    g_reload = 1;
+}
+
+/*
+ * read the configuration again and only send to the kernel what it doesn't have
+ * the current targets are kept if the file can't be read
+ */
+static int
+reload_targets(void)
+{
+    struct target_set wanted;
+    if (target_config_load(g_config_path, &wanted))
+    {
+        fprintf(stderr, "[ERROR] Failed to load %s, keeping the current targets\n", g_config_path);
+        return -1;
+    }
+    return target_set_sync(g_socket, &g_targets, &g_table_generation, &wanted) ? -1 : 0;
+}
+
+static int
+print_hook_counters(int socket, FILE *out)
+{
+    struct hydra_hook_counters counters = { 0 };
+    socklen_t len = sizeof(struct hydra_hook_counters);
+    if (getsockopt(socket, SYSPROTO_CONTROL, GET_HOOK_COUNTERS, &counters, &len))
+    {
+        perror("getsockopt GET_HOOK_COUNTERS");
+        return -1;
+    }
+    fprintf(out, "[INFO] Exec hook counters:\n");
+    fprintf(out, "execs: %llu fast path rejects: %llu table hits: %llu constraint rejects: %llu\n",
+            counters.execs, counters.fastpath_rejects, counters.table_hits, counters.constraint_rejects);
+    fprintf(out, "suspend failures: %llu enqueue failures: %llu rate limited: %llu\n", counters.suspend_failures, counters.enqueue_failures, counters.rate_limited);
+    return 0;
+}
+
+static int
+print_table_state(int socket, FILE *out)
+{
+    struct hydra_table_state state = { 0 };
+    socklen_t len = sizeof(struct hydra_table_state);
+    if (getsockopt(socket, SYSPROTO_CONTROL, GET_TABLE_STATE, &state, &len))
+    {
+        perror("getsockopt GET_TABLE_STATE");
+        return -1;
+    }
+    fprintf(out, "[INFO] Targets table: %u entries generation %llu digest 0x%016llx\n", state.count, state.generation, state.digest);
+    return 0;
+}
+
+static int
+print_pool_stats(int socket, FILE *out)
+{
+    struct hydra_pool_stats stats = { 0 };
+    socklen_t len = sizeof(struct hydra_pool_stats);
+    if (getsockopt(socket, SYSPROTO_CONTROL, GET_POOL_STATS, &stats, &len))
+    {
+        perror("getsockopt GET_POOL_STATS");
+        return -1;
+    }
+    fprintf(out, "[INFO] Targets pool: %u slabs of %u x %u bytes, %u in use (max %u) %llu allocations %llu failures\n",
+            stats.slabs, stats.objects_per_slab, stats.object_size, stats.in_use, stats.max_in_use, stats.allocations, stats.failures);
+    return 0;
+}
+
+/*
+ * drain the messages the kext logged from the exec path
+ */
+static int
+print_kernel_log(int socket, FILE *out)
+{
+    char buffer[sizeof(struct hydra_log_header) + 16 * sizeof(struct hydra_log_record)];
+    struct hydra_log_header *header = (struct hydra_log_header*)buffer;
+    struct hydra_log_record *records = (struct hydra_log_record*)(header + 1);
+    fprintf(out, "[INFO] Kernel log:\n");
+    do
+    {
+        socklen_t len = sizeof(buffer);
+        if (getsockopt(socket, SYSPROTO_CONTROL, GET_LOG, buffer, &len))
+        {
+            perror("getsockopt GET_LOG");
+            return -1;
+        }
+        for (uint32_t i = 0; i < header->count; i++)
+        {
+            fprintf(out, "%llu line %u: %s", records[i].timestamp, records[i].line, records[i].message);
+            if (records[i].suppressed)
+            {
+                fprintf(out, "(%u similar messages suppressed before this one)\n", records[i].suppressed);
+            }
+        }
+    } while (header->pending > 0 && header->count > 0);
+    fprintf(out, "dropped: %llu rate limited: %llu\n", header->dropped, header->suppressed);
+    return 0;
+}
+
+static int
+print_verdict_stats(int socket, FILE *out)
+{
+    struct hydra_verdict_stats stats = { 0 };
+    socklen_t len = sizeof(struct hydra_verdict_stats);
+    if (getsockopt(socket, SYSPROTO_CONTROL, GET_VERDICT_STATS, &stats, &len))
+    {
+        perror("getsockopt GET_VERDICT_STATS");
+        return -1;
+    }
+    fprintf(out, "[INFO] Verdict cache: %u entries hits: %llu misses: %llu expired: %llu evictions: %llu clears: %u\n",
+            stats.entries, stats.hits, stats.misses, stats.expired, stats.evictions, stats.clears);
+    return 0;
+}
+
+static int
+print_degrade_state(int socket, FILE *out)
+{
+    struct hydra_degrade_state state = { { 0 } };
+    socklen_t len = sizeof(struct hydra_degrade_state);
+    if (getsockopt(socket, SYSPROTO_CONTROL, GET_DEGRADE, &state, &len))
+    {
+        perror("getsockopt GET_DEGRADE");
+        return -1;
+    }
+    fprintf(out, "[INFO] Degraded mode: %s outstanding: %u (high %u low %u) queue depth: %u (high %u low %u)\n",
+            state.degraded ? "on" : "off", state.outstanding, state.config.suspended_high, state.config.suspended_low,
+            state.queue_depth, state.config.queue_high, state.config.queue_low);
+    fprintf(out, "transitions: %u events not suspended: %llu\n", state.transitions, state.degraded_events);
+    return 0;
+}
+
+static int
+print_batch_stats(int socket, FILE *out)
+{
+    struct hydra_batch_stats stats = { { 0 } };
+    socklen_t len = sizeof(struct hydra_batch_stats);
+    if (getsockopt(socket, SYSPROTO_CONTROL, GET_BATCH_STATS, &stats, &len))
+    {
+        perror("getsockopt GET_BATCH_STATS");
+        return -1;
+    }
+    fprintf(out, "[INFO] Batching: max delay %u us max %u events, %llu datagrams with %llu events, %llu events lost\n",
+            stats.config.max_delay, stats.config.max_events, stats.datagrams, stats.events, stats.failures);
+    return 0;
+}
+
+static int
+print_targets(int socket, FILE *out)
+{
+    struct target_set set = { 0 };
+    if (target_set_fetch(socket, &set))
+    {
+        return -1;
+    }
+    fprintf(out, "[INFO] Targets:\n");
+    for (size_t i = 0; i < set.count; i++)
+    {
+        struct hydra_target_options *options = &set.entries[i].options;
+        fprintf(out, "%6u %-17s", set.entries[i].id, set.entries[i].name);
+        if (options->flags & TARGET_NOTIFY_ONLY)
+        {
+            fprintf(out, " notify");
+        }
+        if (options->priority == PRIORITY_INTERACTIVE)
+        {
+            fprintf(out, " priority=interactive");
+        }
+        else if (options->priority == PRIORITY_BATCH)
+        {
+            fprintf(out, " priority=batch");
+        }
+        if (options->flags & TARGET_MATCH_UID)
+        {
+            fprintf(out, " uid=%u", options->uid);
+        }
+        if (options->flags & TARGET_MATCH_PARENT)
+        {
+            fprintf(out, " parent=%.*s", MAXCOMLEN, options->parent_name);
+        }
+        if (options->flags & TARGET_MATCH_SESSION)
+        {
+            fprintf(out, " session=%u", options->session);
+        }
+        if (options->rate != 0)
+        {
+            fprintf(out, " rate=%u burst=%u%s", options->rate, options->burst ? options->burst : options->rate,
+                    (options->flags & TARGET_RATE_COALESCE) ? " coalesce" : "");
+        }
+        fprintf(out, "\n");
+    }
+    target_set_free(&set);
+    return 0;
+}
+
+static int
+print_subscribers(int socket, FILE *out)
+{
+    struct hydra_subscriber_stats stats[16];
+    socklen_t len = sizeof(stats);
+    if (getsockopt(socket, SYSPROTO_CONTROL, GET_SUBSCRIBERS, stats, &len))
+    {
+        perror("getsockopt GET_SUBSCRIBERS");
+        return -1;
+    }
+    fprintf(out, "[INFO] Connected clients:\n");
+    for (size_t i = 0; i < len / sizeof(struct hydra_subscriber_stats); i++)
+    {
+        fprintf(out, "unit %u %s enqueued: %llu dropped: %llu queue depth: %u (max %u)\n",
+                stats[i].unit, stats[i].handler ? "handler" : "monitor",
+                stats[i].enqueued, stats[i].dropped, stats[i].queue_depth, stats[i].max_queue_depth);
+    }
+    return 0;
+}
+
+static void
+dump_stats(void)
+{
+    event_log_flush();
+    print_kernel_latency(g_socket, stdout);
+    print_hook_counters(g_socket, stdout);
+    print_table_state(g_socket, stdout);
+    print_pool_stats(g_socket, stdout);
+    print_verdict_stats(g_socket, stdout);
+    print_degrade_state(g_socket, stdout);
+    print_batch_stats(g_socket, stdout);
+    print_subscribers(g_socket, stdout);
+    print_kernel_log(g_socket, stdout);
+    print_daemon_latency(stdout);
+}
+
+/*
+ * the signal handlers only set flags, the work is done here from the main loop
+ */
+static void
+handle_signals(void)
+{
+    if (g_dump_stats)
+    {
+        g_dump_stats = 0;
+        dump_stats();
+    }
+    if (g_reload)
+    {
+        g_reload = 0;
+        if (g_config_path != NULL && !g_monitor)
+        {
+            reload_targets();
+        }
+    }
+}
+
+/*
+ * patch and resume a suspended target
+ */
+static void
+acknowledge_resume(void)
+{
+    uint32_t count = 1;
+    if (setsockopt(g_socket, SYSPROTO_CONTROL, RESUMED, &count, sizeof(count)))
+    {
+        perror("setsockopt RESUMED");
+    }
+}
+
+static void
+handle_event(struct hydra_event *event, uint64_t receive_timestamp)
+{
+    pid_t pid = event->pid;
+    if (event->flags & HYDRA_EVENT_STATE)
+    {
+        if (event->flags & HYDRA_EVENT_DEGRADED)
+        {
+            printf("[WARNING] We are falling behind, the kernel only notifies targets now\n");
+        }
+        else
+        {
+            printf("[INFO] Caught up, the kernel suspends targets again\n");
+        }
+        return;
+    }
+    printf("[INFO] Received pid for target process is %d (target %u uid %d parent %d)\n", pid, event->target_id, event->uid, event->ppid);
+    if (event->suppressed)
+    {
+        printf("[INFO] %u launches of target %u over its rate were suppressed before this one\n", event->suppressed, event->target_id);
+    }
+    // replayed processes are long gone, only the bookkeeping is done
+    if (g_replay)
+    {
+        record_event_latency(event, receive_timestamp, mach_absolute_time());
+        return;
+    }
+    // monitors only watch, the handler connection is the one resuming processes
+    if (g_monitor || !(event->flags & HYDRA_EVENT_SUSPENDED))
+    {
+        return;
+    }
+    mach_port_t task;
+    kern_return_t ret = 0;
+    // the cache keeps the port until the process exits, we hold our own reference while we use it
+    ret = task_cache_lookup(pid, event->start_time, &task);
+    if (ret)
+    {
+        printf("task for pid failed!\n");
+        // nothing left to resume, still tell the kernel we are done with it
+        acknowledge_resume();
+        return;
+    }
+    
+    // do whatever processing and patching we need to the target
+    uint16_t patch1 = 0x9090;
+    mach_msg_type_number_t len = 2;
+#define TARGET_ADDRESS 0
+    // change memory protection to writable
+    mach_vm_protect(task, (mach_vm_address_t)TARGET_ADDRESS, len, FALSE, VM_PROT_READ | VM_PROT_WRITE | VM_PROT_COPY);
+    // patch the process
+    ret = mach_vm_write(task, (mach_vm_address_t)TARGET_ADDRESS, (vm_offset_t)&patch1, len);
+    if (ret)
+    {
+        printf("mach vm write failed! %d\n", ret);
+    }
+    // restore original protection
+    mach_vm_protect(task, (mach_vm_address_t)TARGET_ADDRESS, len, FALSE, VM_PROT_READ | VM_PROT_EXECUTE);
+    task_cache_release(task);
+    // not sure why I added this small pause, maybe some test?
+    sleep(2);
+    // resume process
+    kill(pid, SIGCONT);
+    acknowledge_resume();
+    uint64_t resume_timestamp = mach_absolute_time();
+    record_event_latency(event, receive_timestamp, resume_timestamp);
+    metrics_resumed(event, resume_timestamp);
+    // the next launches of this executable only need a notification
+    if (g_verdict_ttl)
+    {
+        struct hydra_verdict verdict = { event->identity, VERDICT_NOTIFY, g_verdict_ttl };
+        if (setsockopt(g_socket, SYSPROTO_CONTROL, SET_VERDICT, &verdict, sizeof(struct hydra_verdict)))
+        {
+            perror("setsockopt SET_VERDICT");
+        }
+    }
+}
+
+/*
+ * every event goes through here, from the socket, the ring or a replayed log
+ */
+static void
+process_event(struct hydra_event *event, uint64_t receive_timestamp)
+{
+    metrics_event_received(event);
+    event_log_write(event, receive_timestamp);
+    // the workers pick by priority class, replays included so they exercise the same scheduling
+    if (event_scheduler_running())
+    {
+        event_scheduler_submit(event, receive_timestamp);
+        return;
+    }
+    uint64_t start = mach_absolute_time();
+    handle_event(event, receive_timestamp);
+    metrics_worker_busy(start, mach_absolute_time());
+}
+
+/*
+ * allocate the shared ring, keep it wired since the kernel writes to it from the exec path
+ * and ask the kernel to map it
+ */
+static int
+setup_event_ring(int socket)
+{
+    size_t size = 256 * 1024;
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    if (mlock(memory, size))
+    {
+        perror("mlock");
+        munmap(memory, size);
+        return -1;
+    }
+    // doesn't set errno
+    if (event_ring_attach(&g_ring, memory, size, 1))
+    {
+        fprintf(stderr, "[ERROR] Could not set up a ring in %zu bytes\n", size);
+        munmap(memory, size);
+        return -1;
+    }
+    struct hydra_ring_spec spec = { (uint64_t)(uintptr_t)memory, size };
+    if (setsockopt(socket, SYSPROTO_CONTROL, SET_RING, &spec, sizeof(struct hydra_ring_spec)))
+    {
+        perror("setsockopt SET_RING");
+        munmap(memory, size);
+        return -1;
+    }
+    printf("[INFO] Receiving events through a %u entries shared ring\n", (unsigned int)(g_ring.mask + 1));
+    return 0;
+}
+
+/*
+ * process everything the kernel wrote to the ring since the last doorbell
+ */
+static void
+drain_event_ring(void)
+{
+    struct hydra_event event;
+    while (event_ring_consume(&g_ring, &event))
+    {
+        process_event(&event, mach_absolute_time());
+    }
+}
+
+static void
+usage(const char *name)
+{
+    printf("Usage: %s [-s] [-l] [-m] [-R] [-c config] [-w log] [-M socket] [-V ttl] [-D marks] [-B delay] [-W workers] [-i target id] [-u uid] [-p parent pid]\n", name);
+    printf("       %s -r log [-x speed]\n", name);
+    printf("  -s  print kernel side latency statistics, hook counters, clients and log and exit\n");
+    printf("  -l  list the targets the kernel has and exit\n");
+    printf("  -m  connect as a monitor, receive events but leave the processes to the handler\n");
+    printf("  -R  receive events through a shared memory ring, the socket only wakes us up\n");
+    printf("  -c  targets configuration file, reloaded on SIGHUP\n");
+    printf("  -w  append every received event to a binary log\n");
+    printf("  -M  serve metrics as text on this Unix socket\n");
+    printf("  -V  after patching a target only ask for notifications about its executable for ttl seconds\n");
+    printf("  -D  suspended high:low[:queue high:low], stop suspending while this many processes or events wait for us\n");
+    printf("  -B  delay[:events], let the kernel hold events up to delay microseconds to send them together\n");
+    printf("  -W  number of threads handling events, most urgent class first, default 1\n");
+    printf("  -r  replay a log without connecting to the kernel, -x speeds it up, 0 is as fast as possible\n");
+    printf("  -i, -u, -p  only receive events for this target id, user or parent process\n");
+    printf("Send SIGUSR1 to a running daemon to print its statistics\n");
+}
 
 int main(int argc, const char * argv[])
 {
     struct sockaddr_ctl sc = { 0 };
     struct ctl_info ctl_info = { 0 };
     int ret = 0;
+    int print_stats = 0;
+    int list_targets = 0;
+    struct hydra_filter filter = { 0 };
+    const char *record_path = NULL;
+    const char *metrics_path = NULL;
+    int metrics_socket = -1;
+    const char *replay_path = NULL;
+    double replay_speed = 1.0;
+    
+    int ch = 0;
+    while ((ch = getopt(argc, (char * const *)argv, "slmRc:w:r:x:M:V:D:B:W:i:u:p:h")) != -1)
+    {
+        switch (ch)
+        {
+            case 's':
+                print_stats = 1;
+                break;
+            case 'l':
+                list_targets = 1;
+                break;
+            case 'm':
+                g_monitor = 1;
+                break;
+            case 'R':
+                g_use_ring = 1;
+                break;
+            case 'c':
+                g_config_path = optarg;
+                break;
+            case 'w':
+                record_path = optarg;
+                break;
+            case 'r':
+                replay_path = optarg;
+                break;
+            case 'x':
+                replay_speed = strtod(optarg, NULL);
+                break;
+            case 'M':
+                metrics_path = optarg;
+                break;
+            case 'V':
+                g_verdict_ttl = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'D':
+                if (sscanf(optarg, "%u:%u:%u:%u", &g_degrade.suspended_high, &g_degrade.suspended_low,
+                           &g_degrade.queue_high, &g_degrade.queue_low) < 2)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'B':
+                if (sscanf(optarg, "%u:%u", &g_batch.max_delay, &g_batch.max_events) < 1)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'W':
+                g_workers = (int)strtol(optarg, NULL, 0);
+                break;
+            case 'i':
+                filter.flags |= HYDRA_FILTER_TARGET;
+                filter.target_id = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'u':
+                filter.flags |= HYDRA_FILTER_UID;
+                filter.uid = (uid_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                filter.flags |= HYDRA_FILTER_PPID;
+                filter.ppid = (pid_t)strtol(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    
+    if (replay_path != NULL)
+    {
+        g_replay = 1;
+        uint64_t start = mach_absolute_time();
+        if (event_scheduler_start(g_workers, handle_event))
+        {
+            exit(1);
+        }
+        ret = event_log_replay(replay_path, replay_speed, process_event);
+        // waits for the workers to finish what was queued
+        event_scheduler_stop();
+        if (ret < 0)
+        {
+            exit(1);
+        }
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        printf("[INFO] Replayed %d events in %llu ms\n", ret, (mach_absolute_time() - start) * timebase.numer / timebase.denom / 1000000ULL);
+        print_daemon_latency(stdout);
+        return 0;
+    }
+    if (record_path != NULL && event_log_open(record_path))
+    {
+        exit(1);
+    }
     
     g_socket = socket(PF_SYSTEM, SOCK_DGRAM, SYSPROTO_CONTROL);
     if (g_socket < 0)
@@ -116,48 +684,201 @@ int main(int argc, const char * argv[])
         exit(1);
     }
     
-    // add a target to the kernel list
-    if (!ret)
+    if (list_targets)
     {
-        char *target = "Dash";
-        ret = setsockopt(g_socket, SYSPROTO_CONTROL, ADD_APP, (void*)target, (socklen_t)strlen(target)+1);
-        if (ret)
-            printf("socket send failed!\n");
+        ret = print_targets(g_socket, stdout);
+        close(g_socket);
+        return ret ? 1 : 0;
     }
-    pid_t pid;
+    if (print_stats)
+    {
+        ret = print_kernel_latency(g_socket, stdout) || print_hook_counters(g_socket, stdout) ||
+              print_table_state(g_socket, stdout) || print_pool_stats(g_socket, stdout) ||
+              print_verdict_stats(g_socket, stdout) || print_degrade_state(g_socket, stdout) ||
+              print_batch_stats(g_socket, stdout) || print_subscribers(g_socket, stdout) ||
+              print_kernel_log(g_socket, stdout);
+        close(g_socket);
+        return ret ? 1 : 0;
+    }
+    
+    // no SA_RESTART so a blocked kevent() returns and we can print the statistics
+    struct sigaction sa = { 0 };
+    sa.sa_handler = dump_stats_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    sa.sa_handler = reload_handler;
+    sigaction(SIGHUP, &sa, NULL);
+    
+    // let the kernel drop what we don't care about before it's queued
+    if (filter.flags && setsockopt(g_socket, SYSPROTO_CONTROL, SET_FILTER, &filter, sizeof(struct hydra_filter)))
+    {
+        perror("setsockopt SET_FILTER");
+        exit(1);
+    }
+    // must be in place before we become the handler, else the first events would use the socket
+    if (g_use_ring && setup_event_ring(g_socket))
+    {
+        exit(1);
+    }
+    // only one client resumes the processes, the kernel doesn't suspend anything while there's none
+    if (!g_monitor && setsockopt(g_socket, SYSPROTO_CONTROL, SET_HANDLER, NULL, 0))
+    {
+        perror("setsockopt SET_HANDLER, is another daemon running?");
+        exit(1);
+    }
+    // the kernel keeps the marks after we are gone so always send them, zeroes turn it off
+    if (!g_monitor && setsockopt(g_socket, SYSPROTO_CONTROL, SET_DEGRADE, &g_degrade, sizeof(struct hydra_degrade_config)))
+    {
+        perror("setsockopt SET_DEGRADE");
+        exit(1);
+    }
+    // batching is per kernel, only the handler decides
+    if (!g_monitor && setsockopt(g_socket, SYSPROTO_CONTROL, SET_BATCH, &g_batch, sizeof(struct hydra_batch_config)))
+    {
+        perror("setsockopt SET_BATCH");
+        exit(1);
+    }
+    // the kernel only identifies executables for the cache while we ask for it
+    uint32_t verdict_cache = (g_verdict_ttl != 0);
+    if (!g_monitor && setsockopt(g_socket, SYSPROTO_CONTROL, SET_VERDICT_CACHE, &verdict_cache, sizeof(uint32_t)))
+    {
+        perror("setsockopt SET_VERDICT_CACHE");
+        exit(1);
+    }
+    // add the targets to the kernel list
+    if (!g_monitor)
+    {
+        // a previous daemon might have left the same targets there
+        if (g_config_path != NULL)
+        {
+            if (reload_targets())
+            {
+                exit(1);
+            }
+        }
+        else
+        {
+            struct target_set wanted = { 0 };
+            target_set_add(&wanted, "Dash");
+            target_set_sync(g_socket, &g_targets, &g_table_generation, &wanted);
+        }
+    }
+    // wait for kernel events and for the exit of processes we hold task ports for
+    int kq = kqueue();
+    if (kq < 0)
+    {
+        perror("kqueue");
+        exit(1);
+    }
+    struct kevent changes[3];
+    EV_SET(&changes[0], g_socket, EVFILT_READ, EV_ADD, 0, 0, NULL);
+    // a signal that lands between the flag checks and kevent() still wakes it up
+    EV_SET(&changes[1], SIGUSR1, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+    EV_SET(&changes[2], SIGHUP, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+    if (kevent(kq, changes, 3, NULL, 0, NULL) < 0)
+    {
+        perror("kevent");
+        exit(1);
+    }
+    struct kevent change;
+    task_cache_init(kq);
+    if (event_scheduler_start(g_workers, handle_event))
+    {
+        exit(1);
+    }
+    if (metrics_path != NULL)
+    {
+        metrics_socket = metrics_listen(metrics_path);
+        EV_SET(&change, metrics_socket, EVFILT_READ, EV_ADD, 0, 0, NULL);
+        if (metrics_socket < 0 || kevent(kq, &change, 1, NULL, 0, NULL) < 0)
+        {
+            exit(1);
+        }
+    }
+    
+    // a datagram can carry a batch of events
+    struct hydra_event events[HYDRA_BATCH_MAX];
     ssize_t n;
     // loop and get target processes from kernel
-    while ((n = recv(g_socket, &pid, sizeof(pid_t), 0)))
+    while (1)
     {
-        printf("[INFO] Received pid for target process is %d\n", pid);
-        mach_port_t task;
-        kern_return_t ret = 0;
-        ret = task_for_pid(mach_task_self(), pid, &task);
-        if (ret)
+        // every time around, a signal that came while we were handling an event doesn't wait for the next one
+        handle_signals();
+        struct kevent kev;
+        if (kevent(kq, NULL, 0, &kev, 1, NULL) < 0)
         {
-            printf("task for pid failed!\n");
+            if (errno != EINTR)
+            {
+                perror("kevent");
+                break;
+            }
             continue;
         }
-        
-        // do whatever processing and patching we need to the target
-        uint16_t patch1 = 0x9090;
-        mach_msg_type_number_t len = 2;
-#define TARGET_ADDRESS 0
-        // change memory protection to writable
-        mach_vm_protect(task, (mach_vm_address_t)TARGET_ADDRESS, len, FALSE, VM_PROT_READ | VM_PROT_WRITE | VM_PROT_COPY);
-        // patch the process
-        ret = mach_vm_write(task, (mach_vm_address_t)TARGET_ADDRESS, (vm_offset_t)&patch1, len);
-        if (ret)
+        if (kev.filter == EVFILT_SIGNAL)
+        {
+            // the handler already set the flag
+            continue;
+        }
+        if (kev.filter == EVFILT_PROC)
+        {
+            task_cache_remove((pid_t)kev.ident);
+            continue;
+        }
+        if ((int)kev.ident == metrics_socket)
+        {
+            metrics_serve(metrics_socket);
+            continue;
+        }
+        // data is the number of bytes waiting in the socket
+        uint32_t depth = (uint32_t)(kev.data / sizeof(struct hydra_event));
+        if (g_use_ring)
+        {
+            depth += (uint32_t)(g_ring.header->head - g_ring.header->tail);
+        }
+        depth += event_scheduler_depth();
+        metrics_queue_depth(depth);
+        n = recv(g_socket, events, sizeof(events), 0);
+        uint64_t receive_timestamp = mach_absolute_time();
+        if (n == 0)
+        {
+            break;
+        }
+        else if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+            {
+                continue;
+            }
+            perror("recv");
+            break;
+        }
+        else if (g_use_ring && n == sizeof(uint32_t))
+        {
+            // doorbell, everything is in the ring
+            drain_event_ring();
+            continue;
+        }
+        else if (n % sizeof(struct hydra_event) != 0)
+        {
+            printf("[ERROR] Received event with unexpected size %zd\n", n);
+            continue;
+        }
+        // the kernel falls back to the socket when the ring is full, keep the order by draining first
+        if (g_use_ring)
+        {
+            drain_event_ring();
+        }
+        for (size_t i = 0; i < n / sizeof(struct hydra_event); i++)
         {
-            printf("mach vm write failed! %d\n", ret);
+            process_event(&events[i], receive_timestamp);
         }
-        // restore original protection
-        mach_vm_protect(task, (mach_vm_address_t)TARGET_ADDRESS, len, FALSE, VM_PROT_READ | VM_PROT_EXECUTE);
-        // not sure why I added this small pause, maybe some test?
-        sleep(2);
-        // resume process
-        kill(pid, SIGCONT);
     }
+    // whatever was received is still handled
+    event_scheduler_stop();
+    task_cache_flush();
+    event_log_close();
+    metrics_close();
+    print_daemon_latency(stdout);
     printf("[INFO] My work is done, see you later!\n");
     return 0;
 }
@@ -0,0 +1,300 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * The userland daemon to talk to the kernel and process the target apps
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * metrics.c
+ *
+ * Counters and histograms served as text on a local Unix socket
+ *
+ * Every connection gets one snapshot and is closed, one metric per line:
+ * name value, or name{quantile="0.99"} value for the histograms
+ * Updates are atomic adds so the event path never takes a lock
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "metrics.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <mach/mach_time.h>
+
+#include "latency_histogram.h"
+
+struct daemon_metrics
+{
+    uint64_t events_received;
+    uint64_t sequence_gaps;         // times the sequence jumped
+    uint64_t events_lost;           // sum of the jumps
+    uint32_t next_sequence;
+    uint32_t queue_depth;
+    uint32_t max_queue_depth;
+    uint64_t worker_busy;           // mach time units spent processing events
+    uint64_t task_cache_hits;
+    uint32_t degraded;              // the kernel stopped suspending because we are behind
+    uint64_t degraded_events;
+    uint64_t deadline_misses;       // events a worker picked after their class deadline
+    struct latency_histogram task_for_pid;
+    struct latency_histogram suspend_to_resume[PRIORITY_CLASSES];
+};
+
+static struct daemon_metrics g_metrics;
+static mach_timebase_info_data_t g_timebase;
+static uint64_t g_start_timestamp;
+static char g_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+static uint64_t to_nanoseconds(uint64_t start, uint64_t end);
+static const char *g_class_labels[PRIORITY_CLASSES] = {
+    [PRIORITY_NORMAL]       = "class=\"normal\",",
+    [PRIORITY_INTERACTIVE]  = "class=\"interactive\",",
+    [PRIORITY_BATCH]        = "class=\"batch\",",
+};
+
+static void print_histogram(FILE *out, const char *name, const char *label, const struct latency_histogram *histogram);
+
+/*
+ * create the listening socket, the caller adds it to its kqueue and calls metrics_serve() when it's readable
+ */
+int
+metrics_listen(const char *path)
+{
+    mach_timebase_info(&g_timebase);
+    g_start_timestamp = mach_absolute_time();
+    struct sockaddr_un address = { 0 };
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "[ERROR] Metrics socket path is too long\n");
+        return -1;
+    }
+    int listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_socket < 0)
+    {
+        perror("metrics socket");
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strlcpy(address.sun_path, path, sizeof(address.sun_path));
+    // a previous daemon might have left it behind
+    unlink(path);
+    if (bind(listen_socket, (struct sockaddr*)&address, sizeof(address)) || listen(listen_socket, 8))
+    {
+        perror("metrics bind");
+        close(listen_socket);
+        return -1;
+    }
+    fcntl(listen_socket, F_SETFL, O_NONBLOCK);
+    strlcpy(g_path, path, sizeof(g_path));
+    return listen_socket;
+}
+
+/*
+ * write a snapshot to every pending connection
+ */
+void
+metrics_serve(int listen_socket)
+{
+    int client = -1;
+    while ((client = accept(listen_socket, NULL, NULL)) >= 0)
+    {
+        FILE *out = fdopen(client, "w");
+        if (out == NULL)
+        {
+            close(client);
+            continue;
+        }
+        uint64_t uptime = to_nanoseconds(g_start_timestamp, mach_absolute_time());
+        uint64_t busy = to_nanoseconds(0, g_metrics.worker_busy);
+        fprintf(out, "hydra_events_received_total %llu\n", g_metrics.events_received);
+        fprintf(out, "hydra_sequence_gaps_total %llu\n", g_metrics.sequence_gaps);
+        fprintf(out, "hydra_events_lost_total %llu\n", g_metrics.events_lost);
+        fprintf(out, "hydra_queue_depth %u\n", g_metrics.queue_depth);
+        fprintf(out, "hydra_queue_depth_max %u\n", g_metrics.max_queue_depth);
+        fprintf(out, "hydra_worker_busy_seconds_total %.6f\n", busy / 1e9);
+        fprintf(out, "hydra_worker_utilisation %.4f\n", uptime ? (double)busy / uptime : 0.0);
+        fprintf(out, "hydra_task_cache_hits_total %llu\n", g_metrics.task_cache_hits);
+        fprintf(out, "hydra_degraded %u\n", g_metrics.degraded);
+        fprintf(out, "hydra_degraded_events_total %llu\n", g_metrics.degraded_events);
+        fprintf(out, "hydra_deadline_misses_total %llu\n", g_metrics.deadline_misses);
+        print_histogram(out, "hydra_task_for_pid_seconds", "", &g_metrics.task_for_pid);
+        for (int i = 0; i < PRIORITY_CLASSES; i++)
+        {
+            print_histogram(out, "hydra_suspend_to_resume_seconds", g_class_labels[i], &g_metrics.suspend_to_resume[i]);
+        }
+        fclose(out);
+    }
+}
+
+void
+metrics_close(void)
+{
+    if (g_path[0] != '\0')
+    {
+        unlink(g_path);
+    }
+}
+
+#pragma mark Collection, called from the event path
+
+void
+metrics_event_received(const struct hydra_event *event)
+{
+    __sync_fetch_and_add(&g_metrics.events_received, 1);
+    // the kernel numbers the events of each connection, anything skipped was dropped
+    // it only moves forward, a late event leaves it where it is
+    uint32_t next = event->sequence + 1;
+    uint32_t expected = g_metrics.next_sequence;
+    while ((int32_t)(next - expected) > 0)
+    {
+        uint32_t previous = __sync_val_compare_and_swap(&g_metrics.next_sequence, expected, next);
+        if (previous == expected)
+        {
+            break;
+        }
+        expected = previous;
+    }
+    // late events, from the socket when the ring overflowed, are not gaps
+    if ((int32_t)(event->sequence - expected) > 0 && g_metrics.events_received > 1)
+    {
+        __sync_fetch_and_add(&g_metrics.sequence_gaps, 1);
+        __sync_fetch_and_add(&g_metrics.events_lost, (uint32_t)(event->sequence - expected));
+    }
+    if (event->flags & HYDRA_EVENT_STATE)
+    {
+        g_metrics.degraded = (event->flags & HYDRA_EVENT_DEGRADED) ? 1 : 0;
+    }
+    else if (event->flags & HYDRA_EVENT_DEGRADED)
+    {
+        __sync_fetch_and_add(&g_metrics.degraded_events, 1);
+    }
+}
+
+void
+metrics_queue_depth(uint32_t depth)
+{
+    g_metrics.queue_depth = depth;
+    if (depth > g_metrics.max_queue_depth)
+    {
+        g_metrics.max_queue_depth = depth;
+    }
+}
+
+void
+metrics_worker_busy(uint64_t start, uint64_t end)
+{
+    __sync_fetch_and_add(&g_metrics.worker_busy, end - start);
+}
+
+void
+metrics_task_for_pid(uint64_t start, uint64_t end)
+{
+    latency_histogram_record(&g_metrics.task_for_pid, to_nanoseconds(start, end));
+}
+
+void
+metrics_task_cache_hit(void)
+{
+    __sync_fetch_and_add(&g_metrics.task_cache_hits, 1);
+}
+
+void
+metrics_resumed(const struct hydra_event *event, uint64_t resume_timestamp)
+{
+    if (event->suspend_timestamp != 0)
+    {
+        uint32_t class = (event->priority < PRIORITY_CLASSES) ? event->priority : PRIORITY_NORMAL;
+        latency_histogram_record(&g_metrics.suspend_to_resume[class], to_nanoseconds(event->suspend_timestamp, resume_timestamp));
+    }
+}
+
+void
+metrics_deadline_missed(void)
+{
+    __sync_fetch_and_add(&g_metrics.deadline_misses, 1);
+}
+
+#pragma mark Local functions
+
+static uint64_t
+to_nanoseconds(uint64_t start, uint64_t end)
+{
+    if (g_timebase.denom == 0)
+    {
+        mach_timebase_info(&g_timebase);
+    }
+    if (end < start)
+    {
+        return 0;
+    }
+    return (end - start) * g_timebase.numer / g_timebase.denom;
+}
+
+/*
+ * label is empty or ends with a comma so it can go right before the quantile
+ */
+static void
+print_histogram(FILE *out, const char *name, const char *label, const struct latency_histogram *histogram)
+{
+    char braces[64] = "";
+    if (label[0] != '\0')
+    {
+        snprintf(braces, sizeof(braces), "{%.*s}", (int)strlen(label) - 1, label);
+    }
+    fprintf(out, "%s{%squantile=\"0.5\"} %.9f\n", name, label, latency_histogram_percentile(histogram, 500) / 1e9);
+    fprintf(out, "%s{%squantile=\"0.9\"} %.9f\n", name, label, latency_histogram_percentile(histogram, 900) / 1e9);
+    fprintf(out, "%s{%squantile=\"0.99\"} %.9f\n", name, label, latency_histogram_percentile(histogram, 990) / 1e9);
+    fprintf(out, "%s_max%s %.9f\n", name, braces, histogram->max / 1e9);
+    fprintf(out, "%s_count%s %llu\n", name, braces, histogram->count);
+}
@@ -0,0 +1,553 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * The userland daemon to talk to the kernel and process the target apps
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * target_config.c
+ *
+ * Targets configuration file
+ *
+ * One target per line, the process name followed by options, # starts a comment
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "target_config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/kern_control.h>
+#include <sys/sys_domain.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#define MAX_LINE    512
+
+static int compare_specs(const void *a, const void *b);
+static int compare_specs_ordered(const void *a, const void *b);
+static void sort_set(struct target_set *set);
+static char *next_token(char **cursor);
+static int parse_option(struct target_spec *spec, const char *option);
+static int send_spec(int socket, int option, const struct target_spec *spec);
+
+/*
+ * read the file line by line into a fixed buffer, the only allocations are for the set itself
+ * options:
+ *   notify     never suspend, only send the event
+ *   rate=N     at most N events per second, the others are notified without suspending
+ *   burst=N    events allowed at once before the rate applies, defaults to the rate
+ *   coalesce   drop the events over the rate, the next one carries how many were dropped
+ *   uid=N      only processes of this user
+ *   parent=X   only processes whose parent is called X
+ *   session=N  only processes in the session led by pid N
+ *   priority=interactive|normal|batch  order in which the daemon handles the events
+ * a name can be listed again with other uid, parent or session keys, each line is its own target
+ * returns 0 on success, the set is left empty on failure
+ */
+int
+target_config_load(const char *path, struct target_set *set)
+{
+    FILE *config = fopen(path, "r");
+    if (config == NULL)
+    {
+        perror("fopen config");
+        return -1;
+    }
+    memset(set, 0, sizeof(struct target_set));
+    char line[MAX_LINE];
+    int line_number = 0;
+    int error = 0;
+    while (fgets(line, sizeof(line), config) != NULL)
+    {
+        line_number++;
+        size_t len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len-1] != '\n')
+        {
+            // way longer than any valid entry, skip the rest of it
+            int c;
+            while ((c = fgetc(config)) != EOF && c != '\n');
+            fprintf(stderr, "[WARNING] %s:%d line too long, ignored\n", path, line_number);
+            continue;
+        }
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+        {
+            *comment = '\0';
+        }
+        char *cursor = line;
+        char *name = next_token(&cursor);
+        if (name == NULL)
+        {
+            continue;
+        }
+        if (strlen(name) > MAXCOMLEN)
+        {
+            // the kernel only sees the first MAXCOMLEN characters of a process name
+            fprintf(stderr, "[WARNING] %s:%d %s truncated to %d characters\n", path, line_number, name, MAXCOMLEN);
+            name[MAXCOMLEN] = '\0';
+        }
+        if (target_set_add(set, name))
+        {
+            error = -1;
+            break;
+        }
+        char *option = NULL;
+        while ((option = next_token(&cursor)) != NULL)
+        {
+            if (parse_option(&set->entries[set->count-1], option))
+            {
+                fprintf(stderr, "[WARNING] %s:%d unknown option %s\n", path, line_number, option);
+            }
+        }
+    }
+    if (ferror(config))
+    {
+        perror("reading config");
+        error = -1;
+    }
+    fclose(config);
+    if (error)
+    {
+        target_set_free(set);
+        return -1;
+    }
+    sort_set(set);
+    return 0;
+}
+
+/*
+ * append without sorting, used while loading
+ */
+int
+target_set_add(struct target_set *set, const char *name)
+{
+    if (set->count == set->capacity)
+    {
+        size_t capacity = set->capacity ? set->capacity * 2 : 64;
+        struct target_spec *entries = realloc(set->entries, capacity * sizeof(struct target_spec));
+        if (entries == NULL)
+        {
+            perror("realloc");
+            return -1;
+        }
+        set->entries = entries;
+        set->capacity = capacity;
+    }
+    struct target_spec *spec = &set->entries[set->count++];
+    memset(spec, 0, sizeof(struct target_spec));
+    strlcpy(spec->name, name, sizeof(spec->name));
+    spec->order = (uint32_t)(set->count - 1);
+    return 0;
+}
+
+/*
+ * walk both sorted sets together and only send the changes to the kernel
+ * returns the number of failed control calls
+ */
+int
+target_set_apply(int socket, const struct target_set *current, const struct target_set *wanted)
+{
+    size_t i = 0, j = 0;
+    int failures = 0;
+    int added = 0, removed = 0, updated = 0;
+    while (i < current->count || j < wanted->count)
+    {
+        int order = 0;
+        if (i == current->count)
+        {
+            order = 1;
+        }
+        else if (j == wanted->count)
+        {
+            order = -1;
+        }
+        else
+        {
+            order = compare_specs(&current->entries[i], &wanted->entries[j]);
+        }
+        if (order < 0)
+        {
+            // only this variant, the others of the same name stay
+            failures += send_spec(socket, REMOVE_APP_EX, &current->entries[i++]);
+            removed++;
+        }
+        else if (order > 0)
+        {
+            failures += send_spec(socket, ADD_APP_EX, &wanted->entries[j++]);
+            added++;
+        }
+        else
+        {
+            // already there, maybe with other options
+            if (memcmp(&current->entries[i].options, &wanted->entries[j].options, sizeof(struct hydra_target_options)) != 0)
+            {
+                failures += send_spec(socket, ADD_APP_EX, &wanted->entries[j]);
+                updated++;
+            }
+            i++;
+            j++;
+        }
+    }
+    printf("[INFO] Targets updated, %d added %d changed %d removed %zu total\n", added, updated, removed, wanted->count);
+    return failures;
+}
+
+/*
+ * make the kernel table match wanted, which becomes the current set
+ * generation is the table generation after our last sync, if the kernel still has it nobody else touched
+ * the table and the difference from current is enough, if not the digest tells if a full upload is needed
+ * returns the number of failed control calls
+ */
+int
+target_set_sync(int socket, struct target_set *current, uint64_t *generation, struct target_set *wanted)
+{
+    struct hydra_table_state state = { 0 };
+    socklen_t len = sizeof(struct hydra_table_state);
+    int failures = 0;
+    int known = (getsockopt(socket, SYSPROTO_CONTROL, GET_TABLE_STATE, &state, &len) == 0);
+    if (known && state.generation == *generation)
+    {
+        failures = target_set_apply(socket, current, wanted);
+    }
+    else if (known && state.count == wanted->count && state.digest == target_set_digest(wanted))
+    {
+        printf("[INFO] Kernel already has the %zu targets, nothing to upload\n", wanted->count);
+    }
+    else
+    {
+        // changed behind our back or we just started, read what's there and fix the difference
+        struct target_set kernel = { 0 };
+        if (target_set_fetch(socket, &kernel) == 0)
+        {
+            failures = target_set_apply(socket, &kernel, wanted);
+        }
+        else
+        {
+            if (setsockopt(socket, SYSPROTO_CONTROL, REMOVE_ALL_APPS, NULL, 0))
+            {
+                perror("setsockopt REMOVE_ALL_APPS");
+                failures++;
+            }
+            failures += target_set_apply(socket, &kernel, wanted);
+        }
+        target_set_free(&kernel);
+    }
+    len = sizeof(struct hydra_table_state);
+    if (failures == 0 && getsockopt(socket, SYSPROTO_CONTROL, GET_TABLE_STATE, &state, &len) == 0)
+    {
+        *generation = state.generation;
+    }
+    else
+    {
+        *generation = TABLE_GENERATION_UNKNOWN;
+    }
+    target_set_free(current);
+    *current = *wanted;
+    memset(wanted, 0, sizeof(struct target_set));
+    return failures;
+}
+
+/*
+ * same digest the kernel keeps, see hydra_target_digest()
+ */
+uint64_t
+target_set_digest(const struct target_set *set)
+{
+    uint64_t digest = 0;
+    for (size_t i = 0; i < set->count; i++)
+    {
+        digest ^= hydra_target_digest(set->entries[i].name, &set->entries[i].options);
+    }
+    return digest;
+}
+
+/*
+ * read the kernel table one page at a time
+ * the listing is retried if the table changed while we were reading it
+ */
+int
+target_set_fetch(int socket, struct target_set *set)
+{
+    char buffer[4096];
+    struct hydra_targets_page *page = (struct hydra_targets_page*)buffer;
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        struct hydra_table_state before = { 0 }, after = { 0 };
+        socklen_t len = sizeof(struct hydra_table_state);
+        if (getsockopt(socket, SYSPROTO_CONTROL, GET_TABLE_STATE, &before, &len))
+        {
+            perror("getsockopt GET_TABLE_STATE");
+            return -1;
+        }
+        memset(set, 0, sizeof(struct target_set));
+        uint32_t cursor = 0;
+        do
+        {
+            page->cursor = cursor;
+            len = sizeof(buffer);
+            if (getsockopt(socket, SYSPROTO_CONTROL, GET_TARGETS, buffer, &len))
+            {
+                perror("getsockopt GET_TARGETS");
+                target_set_free(set);
+                return -1;
+            }
+            const char *entry = (const char*)(page + 1);
+            const char *end = buffer + len;
+            const size_t fixed_len = sizeof(uint32_t) + sizeof(struct hydra_target_options);
+            for (uint32_t i = 0; i < page->count && entry + fixed_len < end; i++)
+            {
+                uint32_t id = 0;
+                struct hydra_target_options options;
+                memcpy(&id, entry, sizeof(uint32_t));
+                memcpy(&options, entry + sizeof(uint32_t), sizeof(struct hydra_target_options));
+                const char *name = entry + fixed_len;
+                size_t name_len = strnlen(name, end - name);
+                if (target_set_add(set, name))
+                {
+                    target_set_free(set);
+                    return -1;
+                }
+                set->entries[set->count-1].id = id;
+                set->entries[set->count-1].options = options;
+                entry = name + name_len + 1;
+            }
+            cursor = page->cursor;
+        } while (cursor != 0);
+        len = sizeof(struct hydra_table_state);
+        if (getsockopt(socket, SYSPROTO_CONTROL, GET_TABLE_STATE, &after, &len) == 0 && after.generation == before.generation)
+        {
+            sort_set(set);
+            return 0;
+        }
+        target_set_free(set);
+    }
+    fprintf(stderr, "[ERROR] Targets table keeps changing, giving up on reading it\n");
+    return -1;
+}
+
+void
+target_set_free(struct target_set *set)
+{
+    free(set->entries);
+    memset(set, 0, sizeof(struct target_set));
+}
+
+/*
+ * sort by name and match keys and drop duplicates, the last one wins once there are options to disagree on
+ * qsort() isn't stable so duplicates are sorted by the order they were added in
+ */
+static void
+sort_set(struct target_set *set)
+{
+    qsort(set->entries, set->count, sizeof(struct target_spec), compare_specs_ordered);
+    size_t unique = 0;
+    for (size_t i = 0; i < set->count; i++)
+    {
+        if (unique > 0 && compare_specs(&set->entries[unique-1], &set->entries[i]) == 0)
+        {
+            set->entries[unique-1] = set->entries[i];
+            continue;
+        }
+        set->entries[unique++] = set->entries[i];
+    }
+    set->count = unique;
+}
+
+/*
+ * same target for the kernel if the name and the match keys are the same
+ */
+static int
+compare_specs(const void *a, const void *b)
+{
+    const struct target_spec *first = a;
+    const struct target_spec *second = b;
+    int order = strcmp(first->name, second->name);
+    if (order != 0)
+    {
+        return order;
+    }
+    return hydra_target_compare_keys(&first->options, &second->options);
+}
+
+/*
+ * returns -1 if the option is unknown
+ */
+static int
+parse_option(struct target_spec *spec, const char *option)
+{
+    if (strcmp(option, "notify") == 0)
+    {
+        spec->options.flags |= TARGET_NOTIFY_ONLY;
+        return 0;
+    }
+    if (strcmp(option, "coalesce") == 0)
+    {
+        spec->options.flags |= TARGET_RATE_COALESCE;
+        return 0;
+    }
+    if (strncmp(option, "parent=", 7) == 0 && option[7] != '\0' && strlen(option + 7) <= MAXCOMLEN)
+    {
+        // the rest of the field stays zero, it's part of the digest
+        memset(spec->options.parent_name, 0, sizeof(spec->options.parent_name));
+        strlcpy(spec->options.parent_name, option + 7, sizeof(spec->options.parent_name));
+        spec->options.flags |= TARGET_MATCH_PARENT;
+        return 0;
+    }
+    if (strcmp(option, "priority=interactive") == 0)
+    {
+        spec->options.priority = PRIORITY_INTERACTIVE;
+        return 0;
+    }
+    if (strcmp(option, "priority=normal") == 0)
+    {
+        spec->options.priority = PRIORITY_NORMAL;
+        return 0;
+    }
+    if (strcmp(option, "priority=batch") == 0)
+    {
+        spec->options.priority = PRIORITY_BATCH;
+        return 0;
+    }
+    uint32_t *number = NULL;
+    uint32_t match = 0;
+    if (strncmp(option, "rate=", 5) == 0)
+    {
+        number = &spec->options.rate;
+    }
+    else if (strncmp(option, "burst=", 6) == 0)
+    {
+        number = &spec->options.burst;
+    }
+    else if (strncmp(option, "uid=", 4) == 0)
+    {
+        number = &spec->options.uid;
+        match = TARGET_MATCH_UID;
+    }
+    else if (strncmp(option, "session=", 8) == 0)
+    {
+        number = &spec->options.session;
+        match = TARGET_MATCH_SESSION;
+    }
+    if (number != NULL)
+    {
+        const char *text = strchr(option, '=') + 1;
+        char *end = NULL;
+        errno = 0;
+        unsigned long value = strtoul(text, &end, 10);
+        if (errno == 0 && end != text && *end == '\0' && value <= UINT32_MAX)
+        {
+            *number = (uint32_t)value;
+            spec->options.flags |= match;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * ADD_APP_EX to add the target or update its options, REMOVE_APP_EX to remove it
+ */
+static int
+send_spec(int socket, int option, const struct target_spec *spec)
+{
+    struct hydra_target_spec kernel_spec = { { 0 } };
+    strlcpy(kernel_spec.name, spec->name, sizeof(kernel_spec.name));
+    kernel_spec.options = spec->options;
+    if (setsockopt(socket, SYSPROTO_CONTROL, option, &kernel_spec, sizeof(struct hydra_target_spec)))
+    {
+        perror((option == ADD_APP_EX) ? "setsockopt ADD_APP_EX" : "setsockopt REMOVE_APP_EX");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * split in place at whitespace, NULL when the line has no more tokens
+ */
+static char *
+next_token(char **cursor)
+{
+    char *start = *cursor;
+    while (*start != '\0' && isspace((unsigned char)*start))
+    {
+        start++;
+    }
+    if (*start == '\0')
+    {
+        *cursor = start;
+        return NULL;
+    }
+    char *end = start;
+    while (*end != '\0' && !isspace((unsigned char)*end))
+    {
+        end++;
+    }
+    if (*end != '\0')
+    {
+        *end++ = '\0';
+    }
+    *cursor = end;
+    return start;
+}
+
+static int
+compare_specs_ordered(const void *a, const void *b)
+{
+    int order = compare_specs(a, b);
+    if (order != 0)
+    {
+        return order;
+    }
+    uint32_t first = ((const struct target_spec*)a)->order;
+    uint32_t second = ((const struct target_spec*)b)->order;
+    return (first > second) - (first < second);
+}
@@ -0,0 +1,218 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * The userland daemon to talk to the kernel and process the target apps
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * task_cache.c
+ *
+ * Cache of task ports so repeated events for the same process reuse the port
+ *
+ * Entries are keyed by pid and process start time so a recycled pid never
+ * gets the port of a dead process. A kqueue NOTE_EXIT is registered for each
+ * cached process and its port is deallocated when it exits.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "task_cache.h"
+
+#include <sys/event.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <mach/mach_time.h>
+
+#include "metrics.h"
+
+// direct mapped by pid, must be a power of 2
+#define TASK_CACHE_SIZE     64
+
+struct task_cache_entry
+{
+    pid_t pid;
+    uint64_t start_time;
+    mach_port_t task;
+};
+
+static struct task_cache_entry g_task_cache[TASK_CACHE_SIZE];
+static int g_kqueue = -1;
+// the workers look up ports while the main loop removes the ones of processes that exited
+static pthread_mutex_t g_task_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void release_entry(struct task_cache_entry *entry);
+
+/*
+ * kq is the queue where the main loop waits, exits are delivered there as EVFILT_PROC
+ */
+void
+task_cache_init(int kq)
+{
+    g_kqueue = kq;
+    memset(g_task_cache, 0, sizeof(g_task_cache));
+}
+
+/*
+ * return the task port for the process, only calling task_for_pid() on a cache miss
+ * the caller gets its own reference and gives it back with task_cache_release()
+ * so the main loop can drop the entry of a process that exited while a worker still uses the port
+ */
+kern_return_t
+task_cache_lookup(pid_t pid, uint64_t start_time, mach_port_t *task)
+{
+    struct task_cache_entry *entry = &g_task_cache[pid & (TASK_CACHE_SIZE - 1)];
+    kern_return_t kr = KERN_SUCCESS;
+    pthread_mutex_lock(&g_task_cache_lock);
+    if (entry->task != MACH_PORT_NULL)
+    {
+        if (entry->pid == pid && entry->start_time == start_time)
+        {
+            *task = entry->task;
+            mach_port_mod_refs(mach_task_self(), *task, MACH_PORT_RIGHT_SEND, 1);
+            pthread_mutex_unlock(&g_task_cache_lock);
+            metrics_task_cache_hit();
+            return KERN_SUCCESS;
+        }
+        // slot used by another process or by a previous process with the same pid
+        release_entry(entry);
+    }
+    pthread_mutex_unlock(&g_task_cache_lock);
+    // the trap can take a while, the other workers and the main loop don't wait for it
+    uint64_t start = mach_absolute_time();
+    kr = task_for_pid(mach_task_self(), pid, task);
+    metrics_task_for_pid(start, mach_absolute_time());
+    if (kr != KERN_SUCCESS)
+    {
+        return kr;
+    }
+    pthread_mutex_lock(&g_task_cache_lock);
+    // the slot may have changed while we weren't holding the lock
+    if (entry->task != MACH_PORT_NULL)
+    {
+        if (entry->pid == pid && entry->start_time == start_time)
+        {
+            // another worker got there first, keep its entry and use our right as the reference
+            pthread_mutex_unlock(&g_task_cache_lock);
+            return KERN_SUCCESS;
+        }
+        release_entry(entry);
+    }
+    entry->pid = pid;
+    entry->start_time = start_time;
+    entry->task = *task;
+    // we want to know when it exits so the port can be released
+    if (g_kqueue >= 0)
+    {
+        struct kevent change;
+        EV_SET(&change, pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, NULL);
+        if (kevent(g_kqueue, &change, 1, NULL, 0, NULL) < 0)
+        {
+            // process is already gone, don't keep a port we won't be told about
+            release_entry(entry);
+            kr = KERN_FAILURE;
+        }
+    }
+    if (kr == KERN_SUCCESS)
+    {
+        mach_port_mod_refs(mach_task_self(), *task, MACH_PORT_RIGHT_SEND, 1);
+    }
+    pthread_mutex_unlock(&g_task_cache_lock);
+    return kr;
+}
+
+/*
+ * give back the reference task_cache_lookup() returned
+ */
+void
+task_cache_release(mach_port_t task)
+{
+    mach_port_deallocate(mach_task_self(), task);
+}
+
+/*
+ * called when the process exits
+ */
+void
+task_cache_remove(pid_t pid)
+{
+    struct task_cache_entry *entry = &g_task_cache[pid & (TASK_CACHE_SIZE - 1)];
+    pthread_mutex_lock(&g_task_cache_lock);
+    if (entry->task != MACH_PORT_NULL && entry->pid == pid)
+    {
+        release_entry(entry);
+    }
+    pthread_mutex_unlock(&g_task_cache_lock);
+}
+
+/*
+ * release all ports, used when the daemon exits
+ */
+void
+task_cache_flush(void)
+{
+    pthread_mutex_lock(&g_task_cache_lock);
+    for (int i = 0; i < TASK_CACHE_SIZE; i++)
+    {
+        if (g_task_cache[i].task != MACH_PORT_NULL)
+        {
+            release_entry(&g_task_cache[i]);
+        }
+    }
+    pthread_mutex_unlock(&g_task_cache_lock);
+}
+
+#pragma mark Local functions
+
+static void
+release_entry(struct task_cache_entry *entry)
+{
+    mach_port_deallocate(mach_task_self(), entry->task);
+    entry->task = MACH_PORT_NULL;
+    entry->pid = 0;
+    entry->start_time = 0;
+}
@@ -0,0 +1,255 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * event_batch.c
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event_batch.h"
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <string.h>
+#include <kern/clock.h>
+#include <kern/thread_call.h>
+
+#include "my_data_definitions.h"
+#include "kext_log.h"
+
+/*
+ * events waiting to go out together to one subscriber slot
+ * the lock is held while sending so the datagrams keep the order of the events
+ */
+struct event_batch
+{
+    lck_mtx_t *lock;
+    thread_call_t flush_call;
+    boolean_t flush_scheduled;
+    kern_ctl_ref ctl_ref;
+    uint32_t unit;                  // 0 once the subscriber is gone
+    uint32_t count;
+    struct hydra_event events[HYDRA_BATCH_MAX];
+};
+
+static struct event_batch g_batches[MAX_SUBSCRIBERS];
+// the configuration lives in the stats, batching is off until SET_BATCH
+static struct hydra_batch_stats g_batch_stats;
+
+static void flush_timer(thread_call_param_t param0, thread_call_param_t param1);
+static errno_t flush_locked(struct event_batch *batch);
+
+kern_return_t
+event_batch_init(lck_grp_t *lock_group)
+{
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+    {
+        g_batches[i].lock = lck_mtx_alloc_init(lock_group, LCK_ATTR_NULL);
+        g_batches[i].flush_call = thread_call_allocate(flush_timer, &g_batches[i]);
+        if (g_batches[i].lock == NULL || g_batches[i].flush_call == NULL)
+        {
+            LOG_MSG("[ERROR] Could not allocate event batch!\n");
+            return KERN_FAILURE;
+        }
+    }
+    return KERN_SUCCESS;
+}
+
+void
+event_batch_free(lck_grp_t *lock_group)
+{
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+    {
+        if (g_batches[i].flush_call != NULL)
+        {
+            // a flush already running still uses the batch and its lock
+            thread_call_cancel_wait(g_batches[i].flush_call);
+            thread_call_free(g_batches[i].flush_call);
+            g_batches[i].flush_call = NULL;
+        }
+        if (g_batches[i].lock != NULL)
+        {
+            lck_mtx_free(g_batches[i].lock, lock_group);
+            g_batches[i].lock = NULL;
+        }
+    }
+}
+
+/*
+ * called from the exec path instead of ctl_enqueuedata(), unread is how many events the subscriber has yet to read
+ * if it has read everything the event goes out alone right away, else it waits up to the configured delay
+ * for others to share the datagram
+ * a suspended process never waits in the batch, it goes out now with whatever is ahead of it
+ * so the caller knows if it was sent and can resume the process if not
+ */
+errno_t
+event_batch_enqueue(uint32_t slot, kern_ctl_ref ctl_ref, uint32_t unit, struct hydra_event *event, uint32_t unread)
+{
+    struct event_batch *batch = &g_batches[slot];
+    uint32_t max_delay = g_batch_stats.config.max_delay;
+    boolean_t suspended = (event->flags & HYDRA_EVENT_SUSPENDED) != 0;
+    errno_t error = 0;
+    lck_mtx_lock(batch->lock);
+    if (batch->count == 0 && (max_delay == 0 || unread == 0 || suspended))
+    {
+        error = ctl_enqueuedata(ctl_ref, unit, event, sizeof(struct hydra_event), 0);
+    }
+    else
+    {
+        batch->ctl_ref = ctl_ref;
+        batch->unit = unit;
+        batch->events[batch->count++] = *event;
+        if (suspended || batch->count >= g_batch_stats.config.max_events)
+        {
+            error = flush_locked(batch);
+        }
+        else if (!batch->flush_scheduled)
+        {
+            uint64_t deadline = 0;
+            clock_interval_to_deadline(max_delay ? max_delay : 1, NSEC_PER_USEC, &deadline);
+            thread_call_enter_delayed(batch->flush_call, deadline);
+            batch->flush_scheduled = TRUE;
+        }
+    }
+    lck_mtx_unlock(batch->lock);
+    return error;
+}
+
+/*
+ * the subscriber disconnected, whatever it didn't get is gone
+ */
+void
+event_batch_discard(uint32_t slot)
+{
+    struct event_batch *batch = &g_batches[slot];
+    lck_mtx_lock(batch->lock);
+    thread_call_cancel(batch->flush_call);
+    batch->flush_scheduled = FALSE;
+    batch->count = 0;
+    batch->unit = 0;
+    lck_mtx_unlock(batch->lock);
+}
+
+/*
+ * events waiting in the batch, read without the lock so it's only an estimate
+ */
+uint32_t
+event_batch_pending(uint32_t slot)
+{
+    return g_batches[slot].count;
+}
+
+void
+event_batch_configure(struct hydra_batch_config *config)
+{
+    if (config->max_events == 0 || config->max_events > HYDRA_BATCH_MAX)
+    {
+        config->max_events = HYDRA_BATCH_MAX;
+    }
+    g_batch_stats.config = *config;
+}
+
+void
+event_batch_stats(struct hydra_batch_stats *stats)
+{
+    *stats = g_batch_stats;
+}
+
+#pragma mark Local functions
+
+/*
+ * the oldest event in the batch waited long enough
+ */
+static void
+flush_timer(thread_call_param_t param0, thread_call_param_t param1)
+{
+    struct event_batch *batch = (struct event_batch*)param0;
+    lck_mtx_lock(batch->lock);
+    batch->flush_scheduled = FALSE;
+    if (batch->unit != 0)
+    {
+        errno_t error = flush_locked(batch);
+        if (error)
+        {
+            LOG_RATE_LIMITED("[ERROR] Failed to send batched events: %d\n", error);
+        }
+    }
+    lck_mtx_unlock(batch->lock);
+}
+
+/*
+ * one datagram with all the events back to back
+ */
+static errno_t
+flush_locked(struct event_batch *batch)
+{
+    if (batch->count == 0)
+    {
+        return 0;
+    }
+    if (batch->flush_scheduled)
+    {
+        thread_call_cancel(batch->flush_call);
+        batch->flush_scheduled = FALSE;
+    }
+    errno_t error = ctl_enqueuedata(batch->ctl_ref, batch->unit, batch->events, batch->count * sizeof(struct hydra_event), 0);
+    if (error)
+    {
+        g_batch_stats.failures += batch->count;
+    }
+    else if (batch->count > 1)
+    {
+        g_batch_stats.datagrams++;
+        g_batch_stats.events += batch->count;
+    }
+    batch->count = 0;
+    return error;
+}
@@ -0,0 +1,242 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * event_ring.h
+ *
+ * Shared memory ring of fixed size event records, an alternative to ctl_enqueuedata
+ *
+ * The daemon allocates the memory and the kernel maps it. Any number of cpus can
+ * produce without locks, each slot carries a sequence number that tells if it's
+ * free or ready. There's a single consumer, the daemon.
+ * Shared between the kernel extension and the userland daemon so it must stay portable
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef hydra_event_ring_h
+#define hydra_event_ring_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "shared_data.h"
+
+#define EVENT_RING_MAGIC        0x48524e47  // HRNG
+#define EVENT_RING_MIN_SIZE     (64 * 1024)
+#define EVENT_RING_MAX_SIZE     (4 * 1024 * 1024)
+// head and the slot sequences can be written by the other side, a producer gives up after this many
+// tries instead of spinning forever on values that never settle
+#define EVENT_RING_PRODUCE_RETRIES  64
+
+// head and tail live in their own cache lines since they are written by different sides
+struct event_ring_header
+{
+    uint32_t magic;
+    uint32_t capacity;              // informative only, both sides compute it from the size
+    uint8_t pad0[56];
+    volatile uint64_t head;         // next slot to reserve, producers
+    uint8_t pad1[56];
+    volatile uint64_t tail;         // next slot to consume, consumer
+    uint8_t pad2[56];
+};
+
+struct event_ring_slot
+{
+    volatile uint64_t sequence;     // == position when free, == position + 1 when ready
+    struct hydra_event event;
+};
+
+/*
+ * local view of the ring, the mask is never read from shared memory
+ * so the other side can't make us write outside the ring
+ */
+struct event_ring
+{
+    struct event_ring_header *header;
+    struct event_ring_slot *slots;
+    uint64_t mask;
+};
+
+/*
+ * number of slots that fit in size bytes, rounded down to a power of 2
+ */
+static inline uint64_t
+event_ring_capacity(size_t size)
+{
+    if (size < EVENT_RING_MIN_SIZE || size > EVENT_RING_MAX_SIZE)
+    {
+        return 0;
+    }
+    uint64_t slots = (size - sizeof(struct event_ring_header)) / sizeof(struct event_ring_slot);
+    uint64_t capacity = 1;
+    while (capacity * 2 <= slots)
+    {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+/*
+ * map a view over memory, the consumer also initializes it
+ * returns 0 on success
+ */
+static inline int
+event_ring_attach(struct event_ring *ring, void *memory, size_t size, int initialize)
+{
+    uint64_t capacity = event_ring_capacity(size);
+    if (memory == NULL || capacity == 0)
+    {
+        return -1;
+    }
+    ring->header = (struct event_ring_header*)memory;
+    ring->slots = (struct event_ring_slot*)((char*)memory + sizeof(struct event_ring_header));
+    ring->mask = capacity - 1;
+    if (initialize)
+    {
+        ring->header->head = 0;
+        ring->header->tail = 0;
+        for (uint64_t i = 0; i < capacity; i++)
+        {
+            ring->slots[i].sequence = i;
+        }
+        ring->header->capacity = (uint32_t)capacity;
+        __sync_synchronize();
+        ring->header->magic = EVENT_RING_MAGIC;
+    }
+    else if (ring->header->magic != EVENT_RING_MAGIC)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * producer side, safe to call from several cpus at the same time
+ * returns -1 if the ring is full or no slot could be reserved in EVENT_RING_PRODUCE_RETRIES tries,
+ * 1 if it was empty before this event and the consumer needs a doorbell, 0 otherwise
+ */
+static inline int
+event_ring_produce(struct event_ring *ring, const struct hydra_event *event)
+{
+    uint64_t position = ring->header->head;
+    struct event_ring_slot *slot = NULL;
+    for (int tries = 0; ; tries++)
+    {
+        if (tries == EVENT_RING_PRODUCE_RETRIES)
+        {
+            return -1;
+        }
+        slot = &ring->slots[position & ring->mask];
+        int64_t difference = (int64_t)(slot->sequence - position);
+        if (difference == 0)
+        {
+            // slot is free, try to reserve it
+            uint64_t previous = __sync_val_compare_and_swap(&ring->header->head, position, position + 1);
+            if (previous == position)
+            {
+                break;
+            }
+            position = previous;
+        }
+        else if (difference < 0)
+        {
+            // the consumer hasn't released this slot yet
+            return -1;
+        }
+        else
+        {
+            // someone else got it first
+            position = ring->header->head;
+        }
+    }
+    slot->event = *event;
+    __sync_synchronize();
+    slot->sequence = position + 1;
+    // pairs with the barrier in event_ring_consume(), either the consumer sees our slot
+    // before it goes to sleep or we see it caught up with us and ring the doorbell
+    __sync_synchronize();
+    return (ring->header->tail == position) ? 1 : 0;
+}
+
+/*
+ * events waiting for the consumer, the indexes may come from the other side so it's clamped
+ */
+static inline uint64_t
+event_ring_depth(struct event_ring *ring)
+{
+    uint64_t depth = ring->header->head - ring->header->tail;
+    return (depth > ring->mask + 1) ? ring->mask + 1 : depth;
+}
+
+/*
+ * consumer side, single thread only
+ * returns 1 and copies the next event if there's one, 0 if the ring is empty
+ */
+static inline int
+event_ring_consume(struct event_ring *ring, struct hydra_event *event)
+{
+    uint64_t position = ring->header->tail;
+    struct event_ring_slot *slot = &ring->slots[position & ring->mask];
+    if ((int64_t)(slot->sequence - (position + 1)) < 0)
+    {
+        return 0;
+    }
+    __sync_synchronize();
+    *event = slot->event;
+    __sync_synchronize();
+    // release the slot for the next lap
+    slot->sequence = position + ring->mask + 1;
+    ring->header->tail = position + 1;
+    __sync_synchronize();
+    return 1;
+}
+
+#endif
@@ -82,6 +82,39 @@ targets_t g_targets_list = NULL;
 struct kernel_info g_kernel_info;
 mach_vm_address_t g_hook_symbol;
 
+// non exported functions used at runtime, defined where they are used
+extern kern_return_t (*_task_suspend)(task_t target_task);
+extern kern_return_t (*_task_resume)(task_t target_task);
+extern struct session *(*_proc_session)(proc_t p);
+extern void (*_session_rele)(struct session *sess);
+extern int (*_cpu_number)(void);
+extern kern_return_t (*_mach_vm_remap)(vm_map_t target_map, mach_vm_offset_t *address, mach_vm_size_t size, mach_vm_offset_t mask, int flags, vm_map_t src_map, mach_vm_offset_t memory_address, boolean_t copy, vm_prot_t *cur_protection, vm_prot_t *max_protection, vm_inherit_t inheritance);
+extern kern_return_t (*_mach_vm_deallocate)(vm_map_t target, mach_vm_offset_t address, mach_vm_size_t size);
+extern vm_map_t (*_get_task_map)(task_t task);
+extern vm_map_t *_kernel_map;
+
+/*
+ * every symbol the hook needs is solved here before the kernel is patched
+ * so the exec path never has to search the symbol table
+ */
+static struct runtime_symbol
+{
+    char *name;
+    void **address;
+} g_runtime_symbols[] = {
+    { "_task_suspend", (void**)&_task_suspend },
+    { "_task_resume",  (void**)&_task_resume },
+    { "_proc_session", (void**)&_proc_session },
+    { "_session_rele", (void**)&_session_rele },
+    { "_cpu_number",   (void**)&_cpu_number },
+    { "_mach_vm_remap", (void**)&_mach_vm_remap },
+    { "_mach_vm_deallocate", (void**)&_mach_vm_deallocate },
+    { "_get_task_map", (void**)&_get_task_map },
+    { "_kernel_map",   (void**)&_kernel_map },
+};
+
+static kern_return_t solve_runtime_symbols(void);
+
 /*
  * where the fun begins
  */
@@ -105,6 +138,11 @@ hydra_start(kmod_info_t * ki, void *d)
         LOG_MSG("[ERROR] Failure to solve proc_resetregister() symbol...\n");
         return KERN_FAILURE;
     }
+    // refuse to load if anything the hook needs is missing
+    if (solve_runtime_symbols() != KERN_SUCCESS)
+    {
+        return KERN_FAILURE;
+    }
     // first we need to store the original bytes
     memcpy(g_original_bytes, (void*)g_hook_symbol, 12);
     // now we can overwrite with the jump to our function
@@ -145,3 +183,22 @@ hydra_stop(kmod_info_t *ki, void *d)
     // all done, bye bye to hydra!
     return KERN_SUCCESS;
 }
+
+/*
+ * solve all symbols in g_runtime_symbols, fails if any is missing
+ */
+static kern_return_t
+solve_runtime_symbols(void)
+{
+    for (int i = 0; i < sizeof(g_runtime_symbols)/sizeof(*g_runtime_symbols); i++)
+    {
+        mach_vm_address_t address = solve_kernel_symbol(&g_kernel_info, g_runtime_symbols[i].name);
+        if (address == 0)
+        {
+            LOG_MSG("[ERROR] Failure to solve %s symbol...\n", g_runtime_symbols[i].name);
+            return KERN_FAILURE;
+        }
+        *g_runtime_symbols[i].address = (void*)address;
+    }
+    return KERN_SUCCESS;
+}
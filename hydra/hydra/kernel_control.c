@@ -64,25 +64,91 @@
 #include <sys/param.h>
 #include <stdint.h>
 #include <sys/kern_control.h>
+#include <kern/clock.h>
+#include <kern/locks.h>
 
 #include "shared_data.h"
 #include "my_data_definitions.h"
+#include "suspend_proc.h"
+#include "user_ring.h"
+#include "slab.h"
+#include "kext_log.h"
+#include "verdict_cache.h"
+#include "event_batch.h"
+
+// enqueue_to_subscriber() result for an event the subscriber filter doesn't want, errno values are positive
+#define ENQUEUE_FILTERED    (-1)
 
 // local functions
 static int ctl_connect(kern_ctl_ref ctl_ref, struct sockaddr_ctl *sac, void **unitinfo);
 static errno_t ctl_disconnect(kern_ctl_ref ctl_ref, u_int32_t unit, void *unitinfo);
 static int ctl_get(kern_ctl_ref ctl_ref, u_int32_t unit, void *unitinfo, int opt, void *data, size_t *len);
 static int ctl_set(kern_ctl_ref ctl_ref, u_int32_t unit, void *unitinfo, int opt, void *data, size_t len);
+static errno_t enqueue_to_subscriber(struct subscriber *subscriber, struct hydra_event *event);
+static boolean_t filter_matches(struct hydra_filter *filter, struct hydra_event *event);
+static boolean_t handler_connected(void);
+static void table_changed(uint64_t digest, int delta);
+static int add_target(const char *name, size_t len, const struct hydra_target_options *options, boolean_t update);
+static void remove_target(targets_t head, targets_t target);
+static int copy_target_spec(const void *data, size_t len, struct hydra_target_spec *spec);
+static boolean_t copy_target_name(const char *name, size_t len, char truncated[MAXCOMLEN+1]);
+static void set_target_options(targets_t target, const struct hydra_target_options *options);
+static size_t fill_targets_page(struct hydra_targets_page *page, size_t len);
+static uint32_t handler_queue_depth(void);
+static boolean_t update_degraded_mode(void);
+static void set_degraded_mode(uint32_t degraded);
+static void suspensions_resumed(uint32_t count);
+static struct subscriber *hold_subscriber(int index);
+static void release_subscriber(int index);
+static void wait_subscriber_users(int index);
+static void targets_write_lock(void);
+static void targets_write_unlock(void);
 
 // vars, external and local
 extern targets_t g_targets_list;
+static uint32_t g_next_target_id = 1;
+static targets_t g_targets_by_id = NULL;
+// target entries are fixed size so they come from a pool instead of one allocation each
+static struct slab_pool g_targets_pool;
+lck_rw_t *g_targets_lock;
+/*
+ * the exec hook counts itself in on its own cpu slot instead of taking g_targets_lock shared
+ * writers still take the lock exclusive, raise g_targets_writer and wait for the slots to drain
+ */
+struct percpu_readers
+{
+    volatile uint32_t count;
+} __attribute__((aligned(64)));
+
+static struct percpu_readers g_targets_readers[MAX_CPUS];
+static volatile uint32_t g_targets_writer = 0;
+extern int (*_cpu_number)(void);
+// describe the targets table, see struct hydra_table_state
+static uint64_t g_table_generation = 0;
+static uint64_t g_table_digest = 0;
+static uint32_t g_table_count = 0;
+// degraded mode, see struct hydra_degrade_config
+static struct hydra_degrade_config g_degrade_config = { 0 };
+static volatile uint32_t g_degraded = 0;
+static volatile uint32_t g_outstanding = 0;
+static uint32_t g_degrade_transitions = 0;
+static uint64_t g_degraded_events = 0;
 
 static boolean_t gKernCtlRegistered = FALSE;
-static int max_clients;
-static uint32_t gClientUnit = 0;
-static kern_ctl_ref gClientCtlRef = NULL;
 static kern_ctl_ref gctl_ref;
 
+/*
+ * every connected client gets a slot and receives all events
+ * only the handler is expected to resume suspended processes, the others are monitors
+ * slots are claimed and released under g_subscribers_lock, the exec path reads them without it
+ * but holds the slot while it does, see hold_subscriber()
+ */
+static struct subscriber g_subscribers[MAX_SUBSCRIBERS];
+// outside the slots so claiming one never resets a count a reader is still holding
+static volatile uint32_t g_subscriber_users[MAX_SUBSCRIBERS];
+static lck_grp_t *g_lock_group;
+static lck_mtx_t *g_subscribers_lock;
+
 #pragma mark Kernel Control struct and handler functions
 
 // described at Network Kernel Extensions Programming Guide
@@ -109,6 +175,37 @@ kern_return_t
 start_kern_control(void)
 {
     errno_t error = 0;
+    g_lock_group = lck_grp_alloc_init("hydra", LCK_GRP_ATTR_NULL);
+    if (g_lock_group == NULL)
+    {
+        LOG_MSG("[ERROR] Could not allocate lock group!\n");
+        return KERN_FAILURE;
+    }
+    g_subscribers_lock = lck_mtx_alloc_init(g_lock_group, LCK_ATTR_NULL);
+    if (g_subscribers_lock == NULL)
+    {
+        LOG_MSG("[ERROR] Could not allocate subscribers lock!\n");
+        return KERN_FAILURE;
+    }
+    if (kext_log_init(g_lock_group) != KERN_SUCCESS)
+    {
+        return KERN_FAILURE;
+    }
+    if (verdict_cache_init(g_lock_group) != KERN_SUCCESS)
+    {
+        return KERN_FAILURE;
+    }
+    if (event_batch_init(g_lock_group) != KERN_SUCCESS)
+    {
+        return KERN_FAILURE;
+    }
+    slab_pool_init(&g_targets_pool, sizeof(struct targets), 32);
+    g_targets_lock = lck_rw_alloc_init(g_lock_group, LCK_ATTR_NULL);
+    if (g_targets_lock == NULL)
+    {
+        LOG_MSG("[ERROR] Could not allocate targets lock!\n");
+        return KERN_FAILURE;
+    }
     // register the kernel control
     error = ctl_register(&gctl_reg, &gctl_ref);
     if (error == 0)
@@ -136,32 +233,627 @@ stop_kern_control(void)
     {
         error = ctl_deregister(gctl_ref);
     }
+    if (g_subscribers_lock != NULL)
+    {
+        lck_mtx_free(g_subscribers_lock, g_lock_group);
+        g_subscribers_lock = NULL;
+    }
+    if (g_targets_lock != NULL)
+    {
+        // the hook is already gone so nobody else is using the table
+        HASH_CLEAR(hh_id, g_targets_by_id);
+        HASH_CLEAR(hh, g_targets_list);
+        slab_pool_destroy(&g_targets_pool);
+        lck_rw_free(g_targets_lock, g_lock_group);
+        g_targets_lock = NULL;
+    }
+    kext_log_free(g_lock_group);
+    verdict_cache_free(g_lock_group);
+    event_batch_free(g_lock_group);
+    if (g_lock_group != NULL)
+    {
+        lck_grp_free(g_lock_group);
+        g_lock_group = NULL;
+    }
     return KERN_SUCCESS;
 }
 
 /*
  * get data ready for userland to grab
- * we only send PID of the suspended process and let the userland daemon do the rest
+ * we send the PID of the suspended process plus the timestamps collected so far
+ * to every subscriber and let the userland daemon do the rest
+ * success means the handler got the event, monitors are best effort
  */
 kern_return_t
-queue_userland_data(pid_t pid)
+queue_userland_data(struct hydra_event *event)
 {
-    errno_t error = 0;
+    kern_return_t kr = KERN_FAILURE;
     
-    if (gClientCtlRef == NULL)
+    event->enqueue_timestamp = mach_absolute_time();
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++)
     {
-        LOG_MSG("[ERROR] No client reference available, can't proceed...\n");
-        return KERN_FAILURE;
+        struct subscriber *subscriber = hold_subscriber(i);
+        if (subscriber == NULL)
+        {
+            continue;
+        }
+        errno_t error = enqueue_to_subscriber(subscriber, event);
+        // filtered out isn't delivered but isn't an error either
+        if (subscriber->handler && error != ENQUEUE_FILTERED)
+        {
+            if (error)
+            {
+                LOG_RATE_LIMITED("[ERROR] ctl_enqueuedata failed with error: %d\n", error);
+            }
+            else
+            {
+                kr = KERN_SUCCESS;
+            }
+        }
+        release_subscriber(i);
     }
-    
-    error = ctl_enqueuedata(gClientCtlRef, gClientUnit, &pid, sizeof(pid_t), 0);
+    return kr;
+}
+
+/*
+ * true if there's a handler and its filter wants this event, else nobody would resume the process
+ */
+boolean_t
+handler_accepts(struct hydra_event *event)
+{
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+    {
+        struct subscriber *subscriber = hold_subscriber(i);
+        if (subscriber == NULL)
+        {
+            continue;
+        }
+        if (subscriber->handler)
+        {
+            boolean_t accepts = filter_matches(&subscriber->filter, event);
+            release_subscriber(i);
+            return accepts;
+        }
+        release_subscriber(i);
+    }
+    return FALSE;
+}
+
+/*
+ * called with g_subscribers_lock held
+ */
+static boolean_t
+handler_connected(void)
+{
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+    {
+        if (g_subscribers[i].unit != 0 && g_subscribers[i].handler)
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * called from the exec path before suspending
+ * while the handler is behind the event is marked and the process is only notified
+ */
+boolean_t
+handler_behind(struct hydra_event *event)
+{
+    if (!update_degraded_mode())
+    {
+        return FALSE;
+    }
+    event->flags |= HYDRA_EVENT_DEGRADED;
+    __sync_fetch_and_add(&g_degraded_events, 1);
+    return TRUE;
+}
+
+/*
+ * the handler got a suspended process, it's outstanding until the handler sends RESUMED
+ */
+void
+suspension_queued(void)
+{
+    __sync_fetch_and_add(&g_outstanding, 1);
+}
+
+static void
+suspensions_resumed(uint32_t count)
+{
+    uint32_t old_value, new_value;
+    do
+    {
+        old_value = g_outstanding;
+        new_value = (count < old_value) ? old_value - count : 0;
+    } while (!__sync_bool_compare_and_swap(&g_outstanding, old_value, new_value));
+}
+
+/*
+ * unread events of the handler, with a ring the socket only has doorbells
+ */
+static uint32_t
+handler_queue_depth(void)
+{
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+    {
+        struct subscriber *subscriber = hold_subscriber(i);
+        if (subscriber == NULL)
+        {
+            continue;
+        }
+        if (!subscriber->handler)
+        {
+            release_subscriber(i);
+            continue;
+        }
+        uint32_t depth = 0;
+        size_t space = 0;
+        if (ctl_getenqueuespace(gctl_ref, subscriber->unit, &space) == 0 && space <= subscriber->capacity)
+        {
+            depth = (uint32_t)((subscriber->capacity - space) / sizeof(struct hydra_event));
+        }
+        depth += event_batch_pending(i) + user_ring_depth(subscriber);
+        release_subscriber(i);
+        return depth;
+    }
+    return 0;
+}
+
+/*
+ * compare the handler backlog with the marks, the gap between high and low keeps it from flapping
+ * returns TRUE while degraded
+ */
+static boolean_t
+update_degraded_mode(void)
+{
+    struct hydra_degrade_config config = g_degrade_config;
+    if (config.suspended_high == 0 && config.queue_high == 0)
+    {
+        return FALSE;
+    }
+    uint32_t outstanding = g_outstanding;
+    uint32_t depth = handler_queue_depth();
+    if (!g_degraded)
+    {
+        if ((config.suspended_high != 0 && outstanding >= config.suspended_high) ||
+            (config.queue_high != 0 && depth >= config.queue_high))
+        {
+            set_degraded_mode(1);
+        }
+    }
+    else if ((config.suspended_high == 0 || outstanding <= config.suspended_low) &&
+             (config.queue_high == 0 || depth <= config.queue_low))
+    {
+        set_degraded_mode(0);
+    }
+    return g_degraded;
+}
+
+/*
+ * several cpus can see the same crossing, only the one that flips the mode reports it
+ */
+static void
+set_degraded_mode(uint32_t degraded)
+{
+    if (!__sync_bool_compare_and_swap(&g_degraded, !degraded, degraded))
+    {
+        return;
+    }
+    __sync_fetch_and_add(&g_degrade_transitions, 1);
+    LOG_RATE_LIMITED("[INFO] Handler %s, suspending is %s\n", degraded ? "is behind" : "caught up", degraded ? "off" : "back on");
+    struct hydra_event event = { 0 };
+    event.flags = HYDRA_EVENT_STATE | (degraded ? HYDRA_EVENT_DEGRADED : 0);
+    event.exec_timestamp = mach_absolute_time();
+    queue_userland_data(&event);
+}
+
+/*
+ * queue the event to a single subscriber
+ * monitors with too many unread events are skipped so a slow monitor never stalls the exec path
+ * returns ENQUEUE_FILTERED if the subscriber doesn't want it, else 0 or the error
+ */
+static errno_t
+enqueue_to_subscriber(struct subscriber *subscriber, struct hydra_event *event)
+{
+    // not interested, don't waste a copy and socket buffer space
+    if (!filter_matches(&subscriber->filter, event))
+    {
+        return ENQUEUE_FILTERED;
+    }
+    // each subscriber has its own sequence so gaps show it lost events, including the ones dropped here
+    event->sequence = __sync_fetch_and_add(&subscriber->sequence, 1);
+    size_t space = 0;
+    if (ctl_getenqueuespace(gctl_ref, subscriber->unit, &space) == 0)
+    {
+        // the buffer is empty the first time we look at it so the largest space seen is its size
+        if (space > subscriber->capacity)
+        {
+            subscriber->capacity = (uint32_t)space;
+        }
+        subscriber->queue_depth = (uint32_t)((subscriber->capacity - space) / sizeof(struct hydra_event));
+        if (subscriber->queue_depth > subscriber->max_queue_depth)
+        {
+            subscriber->max_queue_depth = subscriber->queue_depth;
+        }
+        if (!subscriber->handler && subscriber->queue_depth >= MONITOR_MAX_QUEUE_DEPTH)
+        {
+            __sync_fetch_and_add(&subscriber->dropped, 1);
+            return ENOBUFS;
+        }
+    }
+    // with a ring the socket only carries the doorbell, unless the ring is full or we gave up on it
+    int ring_result = user_ring_produce(subscriber, event);
+    if (ring_result >= 0)
+    {
+        __sync_fetch_and_add(&subscriber->enqueued, 1);
+        if (ring_result == 1)
+        {
+            // if this fails the socket already has something unread and the daemon will drain the ring anyway
+            uint32_t doorbell = HYDRA_RING_DOORBELL;
+            ctl_enqueuedata(gctl_ref, subscriber->unit, &doorbell, sizeof(doorbell), 0);
+        }
+        return 0;
+    }
+    errno_t error = event_batch_enqueue((uint32_t)(subscriber - g_subscribers), gctl_ref, subscriber->unit, event, subscriber->queue_depth);
     if (error)
     {
-        LOG_MSG("[ERROR] ctl_enqueuedata failed with error: %d\n", error);
-        return KERN_FAILURE;
+        __sync_fetch_and_add(&subscriber->dropped, 1);
+    }
+    else
+    {
+        __sync_fetch_and_add(&subscriber->enqueued, 1);
+    }
+    return error;
+}
+
+/*
+ * a few compares so it's cheap enough to run for every subscriber from the exec path
+ */
+static boolean_t
+filter_matches(struct hydra_filter *filter, struct hydra_event *event)
+{
+    uint32_t flags = filter->flags;
+    // mode changes aren't about any process, everyone gets them
+    if (flags == 0 || (event->flags & HYDRA_EVENT_STATE))
+    {
+        return TRUE;
+    }
+    if ((flags & HYDRA_FILTER_TARGET) && filter->target_id != event->target_id)
+    {
+        return FALSE;
+    }
+    if ((flags & HYDRA_FILTER_UID) && filter->uid != event->uid)
+    {
+        return FALSE;
+    }
+    if ((flags & HYDRA_FILTER_PPID) && filter->ppid != event->ppid)
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * the exec path announces itself before looking at the slot, same as user_ring_produce()
+ * returns NULL if the slot is free, else the slot stays valid until release_subscriber()
+ */
+static struct subscriber *
+hold_subscriber(int index)
+{
+    __sync_fetch_and_add(&g_subscriber_users[index], 1);
+    if (g_subscribers[index].unit == 0)
+    {
+        __sync_fetch_and_sub(&g_subscriber_users[index], 1);
+        return NULL;
+    }
+    return &g_subscribers[index];
+}
+
+static void
+release_subscriber(int index)
+{
+    __sync_fetch_and_sub(&g_subscriber_users[index], 1);
+}
+
+/*
+ * called with g_subscribers_lock held after the unit was cleared
+ * readers only hold a slot while they queue one event so this is short
+ */
+static void
+wait_subscriber_users(int index)
+{
+    __sync_synchronize();
+    while (g_subscriber_users[index] != 0)
+    {
+        struct timespec ts = { 0, 1000000 };
+        msleep((void*)&g_subscriber_users[index], NULL, PUSER, "hydra_subscriber", &ts);
+    }
+}
+
+/*
+ * readers of the targets table in the exec hook, returns the cookie to pass to targets_read_unlock()
+ * while a writer is active we queue behind it on the real lock
+ */
+int
+targets_read_lock(void)
+{
+    // the slot is remembered since the thread can move to another cpu before it unlocks
+    int cpu = _cpu_number() & (MAX_CPUS - 1);
+    __sync_fetch_and_add(&g_targets_readers[cpu].count, 1);
+    if (g_targets_writer == 0)
+    {
+        return cpu;
+    }
+    __sync_fetch_and_sub(&g_targets_readers[cpu].count, 1);
+    lck_rw_lock_shared(g_targets_lock);
+    return -1;
+}
+
+void
+targets_read_unlock(int cookie)
+{
+    if (cookie < 0)
+    {
+        lck_rw_unlock_shared(g_targets_lock);
+        return;
+    }
+    __sync_fetch_and_sub(&g_targets_readers[cookie].count, 1);
+}
+
+/*
+ * the hook only holds a slot to find a target and copy it so the wait is short
+ */
+static void
+targets_write_lock(void)
+{
+    lck_rw_lock_exclusive(g_targets_lock);
+    g_targets_writer = 1;
+    // pairs with the increment in targets_read_lock(), either the reader sees the flag or we see its count
+    __sync_synchronize();
+    for (;;)
+    {
+        uint32_t readers = 0;
+        for (int i = 0; i < MAX_CPUS; i++)
+        {
+            readers += g_targets_readers[i].count;
+        }
+        if (readers == 0)
+        {
+            break;
+        }
+        struct timespec ts = { 0, 1000000 };
+        msleep((void*)&g_targets_writer, NULL, PUSER, "hydra_targets", &ts);
+    }
+}
+
+static void
+targets_write_unlock(void)
+{
+    g_targets_writer = 0;
+    lck_rw_unlock_exclusive(g_targets_lock);
+}
+
+/*
+ * keep the table state in sync, digest is the target digest to add or remove
+ * delta is 1 when a target was added, -1 when removed and 0 when updated
+ */
+static void
+table_changed(uint64_t digest, int delta)
+{
+    g_table_generation++;
+    g_table_digest ^= digest;
+    g_table_count += delta;
+    // verdicts were given for the old set
+    verdict_cache_clear();
+}
+
+/*
+ * add a target, an existing one only gets its options changed if update is set
+ * a target is its name and match keys, other keys for a known name are a new variant on the list of that name
+ * the process name will be truncated at MAXCOMLEN so it's stored and looked up the way the hook will see it
+ */
+static int
+add_target(const char *name, size_t len, const struct hydra_target_options *options, boolean_t update)
+{
+    char truncated[MAXCOMLEN+1];
+    if (!copy_target_name(name, len, truncated))
+    {
+        return EINVAL;
+    }
+    int error = 0;
+    targets_write_lock();
+    targets_t head = NULL;
+    HASH_FIND_STR(g_targets_list, truncated, head);
+    targets_t last = NULL;
+    targets_t temp = head;
+    int variants = 0;
+    for (; temp != NULL && hydra_target_compare_keys(&temp->options, options) != 0; temp = temp->next_variant)
+    {
+        last = temp;
+        variants++;
+    }
+    if (temp == NULL)
+    {
+        if (variants >= MAX_TARGET_VARIANTS)
+        {
+            error = ENOSPC;
+        }
+        else if ((temp = slab_alloc(&g_targets_pool)) == NULL)
+        {
+            error = ENOMEM;
+        }
+        else
+        {
+            strlcpy(temp->name, truncated, sizeof(temp->name));
+            temp->id = g_next_target_id++;
+            set_target_options(temp, options);
+            if (head == NULL || !(options->flags & TARGET_MATCH_MASK))
+            {
+                // a name only variant goes first so the hook finds it with the name hash alone, like before variants
+                if (head != NULL)
+                {
+                    HASH_DEL(g_targets_list, head);
+                }
+                temp->next_variant = head;
+                HASH_ADD_KEYPTR(hh, g_targets_list, temp->name, (int)strlen(temp->name), temp);
+            }
+            else
+            {
+                last->next_variant = temp;
+            }
+            HASH_ADD(hh_id, g_targets_by_id, id, sizeof(uint32_t), temp);
+            table_changed(hydra_target_digest(temp->name, &temp->options), 1);
+        }
+    }
+    else if (update && bcmp(&temp->options, options, sizeof(struct hydra_target_options)) != 0)
+    {
+        uint64_t old_digest = hydra_target_digest(temp->name, &temp->options);
+        set_target_options(temp, options);
+        table_changed(old_digest ^ hydra_target_digest(temp->name, &temp->options), 0);
+    }
+    targets_write_unlock();
+    return error;
+}
+
+/*
+ * unlink a variant and give it back to the pool, head is the first variant of its name
+ * called with the table locked exclusive, the next variant takes the place of a removed head in the name hash
+ */
+static void
+remove_target(targets_t head, targets_t target)
+{
+    if (target == head)
+    {
+        HASH_DEL(g_targets_list, head);
+        if (head->next_variant != NULL)
+        {
+            HASH_ADD_KEYPTR(hh, g_targets_list, head->next_variant->name, (int)strlen(head->next_variant->name), head->next_variant);
+        }
+    }
+    else
+    {
+        targets_t previous = head;
+        while (previous->next_variant != target)
+        {
+            previous = previous->next_variant;
+        }
+        previous->next_variant = target->next_variant;
     }
+    table_changed(hydra_target_digest(target->name, &target->options), -1);
+    HASH_DELETE(hh_id, g_targets_by_id, target);
+    slab_free(&g_targets_pool, target);
+}
+
+/*
+ * ADD_APP_EX and REMOVE_APP_EX buffer, the options are hashed and compared as they are
+ * so nothing after the parent name may differ
+ */
+static int
+copy_target_spec(const void *data, size_t len, struct hydra_target_spec *spec)
+{
+    if (len != sizeof(struct hydra_target_spec) || data == NULL)
+    {
+        return EINVAL;
+    }
+    bcopy(data, spec, sizeof(struct hydra_target_spec));
+    if (spec->options.priority >= PRIORITY_CLASSES)
+    {
+        return EINVAL;
+    }
+    spec->options.parent_name[MAXCOMLEN] = '\0';
+    size_t parent_len = strlen(spec->options.parent_name);
+    bzero(spec->options.parent_name + parent_len, sizeof(spec->options.parent_name) - parent_len);
+    return 0;
+}
+
+/*
+ * names are stored and looked up the way the hook will see them, truncated at MAXCOMLEN
+ * the caller buffer isn't necessarily nul terminated so never read past len
+ * returns FALSE for an empty name
+ */
+static boolean_t
+copy_target_name(const char *name, size_t len, char truncated[MAXCOMLEN+1])
+{
+    size_t i = 0;
+    for (; i < len && i < MAXCOMLEN && name[i] != '\0'; i++)
+    {
+        truncated[i] = name[i];
+    }
+    truncated[i] = '\0';
+    return (truncated[0] != '\0');
+}
+
+/*
+ * the rate is converted once here so the exec hook works in mach_absolute_time() units
+ * called with the table locked exclusive, a new rate starts with a full bucket
+ */
+static void
+set_target_options(targets_t target, const struct hydra_target_options *options)
+{
+    target->options = *options;
+    uint64_t interval = 0;
+    if (options->rate != 0)
+    {
+        nanoseconds_to_absolutetime(1000000000ULL / options->rate, &interval);
+    }
+    token_bucket_init(&target->bucket, interval, options->burst ? options->burst : options->rate);
+}
+
+/*
+ * copy as many targets as fit after the page header, starting after the cursor
+ * targets are appended to the id list and ids only grow so it's in id order, variants included
+ * returns the number of bytes used
+ */
+static size_t
+fill_targets_page(struct hydra_targets_page *page, size_t len)
+{
+    uint32_t cursor = page->cursor;
+    char *out = (char*)(page + 1);
+    char *end = (char*)page + len;
+    targets_t target = NULL;
     
-    return KERN_SUCCESS;
+    page->count = 0;
+    // only held for one page, the next call finds its place again
+    lck_rw_lock_shared(g_targets_lock);
+    if (cursor == 0)
+    {
+        target = g_targets_by_id;
+    }
+    else
+    {
+        HASH_FIND(hh_id, g_targets_by_id, &cursor, sizeof(uint32_t), target);
+        if (target != NULL)
+        {
+            target = target->hh_id.next;
+        }
+        else
+        {
+            // the last target we returned is gone, skip everything up to it
+            for (target = g_targets_by_id; target != NULL && target->id <= cursor; target = target->hh_id.next);
+        }
+    }
+    for (; target != NULL; target = target->hh_id.next)
+    {
+        size_t name_len = strlen(target->name) + 1;
+        size_t entry_len = sizeof(uint32_t) + sizeof(struct hydra_target_options) + name_len;
+        if (out + entry_len > end)
+        {
+            break;
+        }
+        bcopy(&target->id, out, sizeof(uint32_t));
+        bcopy(&target->options, out + sizeof(uint32_t), sizeof(struct hydra_target_options));
+        bcopy(target->name, out + sizeof(uint32_t) + sizeof(struct hydra_target_options), name_len);
+        out += entry_len;
+        cursor = target->id;
+        page->count++;
+    }
+    // more to come if we stopped before the end
+    page->cursor = (target != NULL) ? cursor : 0;
+    lck_rw_unlock_shared(g_targets_lock);
+    return out - (char*)page;
 }
 
 #pragma mark Kernel Control handler functions
@@ -173,18 +865,27 @@ queue_userland_data(pid_t pid)
 static int
 ctl_connect(kern_ctl_ref ctl_ref, struct sockaddr_ctl *sac, void **unitinfo)
 {
-    // we only accept a single client
-    if (max_clients > 0)
+    int error = EBUSY;
+    lck_mtx_lock(g_subscribers_lock);
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+    {
+        if (g_subscribers[i].unit == 0)
+        {
+            // store the unit id of the client that connected
+            // we will need it to queue data to userland
+            bzero(&g_subscribers[i], sizeof(struct subscriber));
+            g_subscribers[i].unit = sac->sc_unit;
+            *unitinfo = &g_subscribers[i];
+            error = 0;
+            break;
+        }
+    }
+    lck_mtx_unlock(g_subscribers_lock);
+    if (error)
     {
         LOG_MSG("[ERROR] Maximum number of clients reached!\n");
-        return EBUSY;
     }
-    max_clients++;
-    // store the unit id and ctl_ref of the client that connected
-    // we will need these to queue data to userland
-    gClientUnit = sac->sc_unit;
-    gClientCtlRef = ctl_ref;
-    return 0;
+    return error;
 }
 
 /*
@@ -193,10 +894,28 @@ ctl_connect(kern_ctl_ref ctl_ref, struct sockaddr_ctl *sac, void **unitinfo)
 static errno_t
 ctl_disconnect(kern_ctl_ref ctl_ref, u_int32_t unit, void *unitinfo)
 {
-    // reset max clients
-    max_clients = 0;
-    gClientUnit = 0;
-    gClientCtlRef = NULL;
+    struct subscriber *subscriber = (struct subscriber*)unitinfo;
+    if (subscriber != NULL)
+    {
+        // free the slot, new readers skip it from now on and the ones inside are waited for
+        int index = (int)(subscriber - g_subscribers);
+        lck_mtx_lock(g_subscribers_lock);
+        subscriber->unit = 0;
+        wait_subscriber_users(index);
+        unmap_user_ring(subscriber);
+        event_batch_discard((uint32_t)index);
+        uint32_t was_handler = subscriber->handler;
+        subscriber->handler = 0;
+        lck_mtx_unlock(g_subscribers_lock);
+        // nothing is suspended without a handler, the next one starts clean
+        if (was_handler)
+        {
+            g_outstanding = 0;
+            set_degraded_mode(0);
+            // the verdicts were its own
+            verdict_cache_enable(FALSE);
+        }
+    }
     return 0;
 }
 
@@ -209,6 +928,12 @@ ctl_get(kern_ctl_ref ctl_ref, u_int32_t unit, void *unitinfo, int opt, void *dat
     int		error = 0;
 	size_t  valsize = 0;
 	void    *buf = NULL;
+    struct hydra_hook_counters counters;
+    struct hydra_table_state table_state;
+    struct hydra_pool_stats pool_stats;
+    struct hydra_verdict_stats verdict_stats;
+    struct hydra_degrade_state degrade_state;
+    struct hydra_batch_stats batch_stats;
 	switch (opt)
     {
         case 0:
@@ -216,6 +941,147 @@ ctl_get(kern_ctl_ref ctl_ref, u_int32_t unit, void *unitinfo, int opt, void *dat
             valsize = 0;
             break;
         }
+        case GET_LATENCY_STATS:
+        {
+            // copy as many targets as the caller has room for directly into its buffer
+            size_t max_entries = (data != NULL) ? *len / sizeof(struct hydra_latency_stats) : 0;
+            struct hydra_latency_stats *stats = (struct hydra_latency_stats*)data;
+            targets_t target = NULL;
+            size_t count = 0;
+            lck_rw_lock_shared(g_targets_lock);
+            // every variant, the name hash only has the first one of each name
+            for (target = g_targets_by_id; target != NULL && count < max_entries; target = target->hh_id.next)
+            {
+                strlcpy(stats[count].name, target->name, sizeof(stats[count].name));
+                stats[count].exec_to_suspend = target->exec_to_suspend;
+                stats[count].exec_to_enqueue = target->exec_to_enqueue;
+                count++;
+            }
+            lck_rw_unlock_shared(g_targets_lock);
+            valsize = count * sizeof(struct hydra_latency_stats);
+            break;
+        }
+        case GET_HOOK_COUNTERS:
+        {
+            get_hook_counters(&counters);
+            buf = &counters;
+            valsize = sizeof(struct hydra_hook_counters);
+            if (*len < valsize)
+            {
+                error = EINVAL;
+            }
+            break;
+        }
+        case GET_TABLE_STATE:
+        {
+            table_state.generation = g_table_generation;
+            table_state.digest = g_table_digest;
+            table_state.count = g_table_count;
+            buf = &table_state;
+            valsize = sizeof(struct hydra_table_state);
+            if (*len < valsize)
+            {
+                error = EINVAL;
+            }
+            break;
+        }
+        case GET_TARGETS:
+        {
+            // the cursor was copied in with the buffer
+            if (data == NULL || *len < sizeof(struct hydra_targets_page) + HYDRA_TARGET_ENTRY_MAX)
+            {
+                error = EINVAL;
+                break;
+            }
+            valsize = fill_targets_page((struct hydra_targets_page*)data, *len);
+            break;
+        }
+        case GET_POOL_STATS:
+        {
+            lck_rw_lock_shared(g_targets_lock);
+            pool_stats = g_targets_pool.stats;
+            lck_rw_unlock_shared(g_targets_lock);
+            buf = &pool_stats;
+            valsize = sizeof(struct hydra_pool_stats);
+            if (*len < valsize)
+            {
+                error = EINVAL;
+            }
+            break;
+        }
+        case GET_LOG:
+        {
+            if (data == NULL || *len < sizeof(struct hydra_log_header) + sizeof(struct hydra_log_record))
+            {
+                error = EINVAL;
+                break;
+            }
+            valsize = kext_log_drain((struct hydra_log_header*)data, *len);
+            break;
+        }
+        case GET_VERDICT_STATS:
+        {
+            verdict_cache_stats(&verdict_stats);
+            buf = &verdict_stats;
+            valsize = sizeof(struct hydra_verdict_stats);
+            if (*len < valsize)
+            {
+                error = EINVAL;
+            }
+            break;
+        }
+        case GET_DEGRADE:
+        {
+            degrade_state.config = g_degrade_config;
+            degrade_state.degraded = g_degraded;
+            degrade_state.outstanding = g_outstanding;
+            degrade_state.queue_depth = handler_queue_depth();
+            degrade_state.transitions = g_degrade_transitions;
+            degrade_state.degraded_events = g_degraded_events;
+            buf = &degrade_state;
+            valsize = sizeof(struct hydra_degrade_state);
+            if (*len < valsize)
+            {
+                error = EINVAL;
+            }
+            break;
+        }
+        case GET_BATCH_STATS:
+        {
+            event_batch_stats(&batch_stats);
+            buf = &batch_stats;
+            valsize = sizeof(struct hydra_batch_stats);
+            if (*len < valsize)
+            {
+                error = EINVAL;
+            }
+            break;
+        }
+        case GET_SUBSCRIBERS:
+        {
+            size_t max_entries = (data != NULL) ? *len / sizeof(struct hydra_subscriber_stats) : 0;
+            struct hydra_subscriber_stats *stats = (struct hydra_subscriber_stats*)data;
+            size_t count = 0;
+            lck_mtx_lock(g_subscribers_lock);
+            for (int i = 0; i < MAX_SUBSCRIBERS && count < max_entries; i++)
+            {
+                struct subscriber *subscriber = &g_subscribers[i];
+                if (subscriber->unit == 0)
+                {
+                    continue;
+                }
+                stats[count].unit            = subscriber->unit;
+                stats[count].handler         = subscriber->handler;
+                stats[count].enqueued        = subscriber->enqueued;
+                stats[count].dropped         = subscriber->dropped;
+                stats[count].queue_depth     = subscriber->queue_depth;
+                stats[count].max_queue_depth = subscriber->max_queue_depth;
+                count++;
+            }
+            lck_mtx_unlock(g_subscribers_lock);
+            valsize = count * sizeof(struct hydra_subscriber_stats);
+            break;
+        }
         default:
             error = ENOTSUP;
             break;
@@ -223,7 +1089,7 @@ ctl_get(kern_ctl_ref ctl_ref, u_int32_t unit, void *unitinfo, int opt, void *dat
     if (error == 0)
     {
         *len = valsize;
-        if (data != NULL) bcopy(buf, data, valsize);
+        if (data != NULL && buf != NULL) bcopy(buf, data, valsize);
     }
     return error;
 }
@@ -243,66 +1109,252 @@ ctl_set(kern_ctl_ref ctl_ref, u_int32_t unit, void *unitinfo, int opt, void *dat
         {
             if (len > 0 && data != NULL)
             {
-                targets_t temp;
-                HASH_FIND_STR(g_targets_list, (char*)data, temp);
-                if (temp == NULL)
-                {
-                    temp = _MALLOC(sizeof(struct targets), 1, M_ZERO);
-                    if (temp != NULL)
-                    {
-                        // the process name will be truncated at MAXCOMLEN so there's no need to allocate more than that
-                        if (len >= MAXCOMLEN)
-                        {
-                            temp->name = _MALLOC(MAXCOMLEN+1, 1, M_ZERO);
-                            len = MAXCOMLEN+1;
-                        }
-                        else
-                        {
-                            // the len should include the space for the nul char
-                            // else we will lose last char
-                            temp->name = _MALLOC(len, 1, M_ZERO);
-                        }
-                        strlcpy(temp->name, (const char*)data, len);
-                        // we need to recompute len or substract 1 else hash will not match strings
-                        HASH_ADD_KEYPTR(hh, g_targets_list, temp->name, (int)strlen(temp->name), temp);
-                    }
-                }
+                struct hydra_target_options options = { 0 };
+                error = add_target((const char*)data, len, &options, FALSE);
+            }
+            break;
+        }
+        case ADD_APP_EX:
+        {
+            struct hydra_target_spec spec;
+            error = copy_target_spec(data, len, &spec);
+            if (error == 0)
+            {
+                error = add_target(spec.name, sizeof(spec.name), &spec.options, TRUE);
             }
             break;
         }
         case REMOVE_APP:
         {
-            if (len > 0 && data != NULL)
+            char truncated[MAXCOMLEN+1];
+            if (len > 0 && data != NULL && copy_target_name((const char*)data, len, truncated))
             {
+                targets_write_lock();
                 targets_t temp;
-                HASH_FIND_STR(g_targets_list, (char*)data, temp);
-                if (temp)
+                HASH_FIND_STR(g_targets_list, truncated, temp);
+                // every variant of the name
+                while (temp)
                 {
 #if DEBUG
                     LOG_MSG("[DEBUG] Found element in list, removing!\n");
 #endif
-                    // free the name string we alloc'ed before
-                    _FREE(temp->name, M_ZERO);
-                    // remove from the list and free the element
-                    HASH_DEL(g_targets_list, temp);
-                    _FREE(temp, M_ZERO);
+                    targets_t next = temp->next_variant;
+                    remove_target(temp, temp);
+                    temp = next;
                 }
+                targets_write_unlock();
             }
             break;
+        }
+        case REMOVE_APP_EX:
+        {
+            struct hydra_target_spec spec;
+            char truncated[MAXCOMLEN+1];
+            error = copy_target_spec(data, len, &spec);
+            if (error != 0)
+            {
+                break;
+            }
+            if (!copy_target_name(spec.name, sizeof(spec.name), truncated))
+            {
+                error = EINVAL;
+                break;
+            }
+            targets_write_lock();
+            targets_t head = NULL;
+            HASH_FIND_STR(g_targets_list, truncated, head);
+            targets_t temp = head;
+            for (; temp != NULL && hydra_target_compare_keys(&temp->options, &spec.options) != 0; temp = temp->next_variant);
+            if (temp != NULL)
+            {
+                remove_target(head, temp);
+            }
+            else
+            {
+                error = ENOENT;
+            }
+            targets_write_unlock();
+            break;
         }
 		case REMOVE_ALL_APPS:
 		{
-			targets_t temp;
-			targets_t target;
-			HASH_ITER(hh, g_targets_list, target, temp)
-            {
-				_FREE(target->name, M_ZERO);
-				HASH_DEL(g_targets_list, target);
-				_FREE(target, M_ZERO);
-			}
-			
+            targets_write_lock();
+            // drop the hash tables and release every entry at once
+            HASH_CLEAR(hh_id, g_targets_by_id);
+            HASH_CLEAR(hh, g_targets_list);
+            slab_pool_reset(&g_targets_pool);
+            g_table_generation++;
+            g_table_digest = 0;
+            g_table_count = 0;
+            verdict_cache_clear();
+            targets_write_unlock();
 			break;
 		}
+        case SET_HANDLER:
+        {
+            // only one subscriber can be in charge of resuming processes
+            struct subscriber *subscriber = (struct subscriber*)unitinfo;
+            lck_mtx_lock(g_subscribers_lock);
+            if (handler_connected())
+            {
+                error = EBUSY;
+            }
+            else
+            {
+                subscriber->handler = 1;
+                g_outstanding = 0;
+            }
+            lck_mtx_unlock(g_subscribers_lock);
+            break;
+        }
+        case SET_FILTER:
+        {
+            struct subscriber *subscriber = (struct subscriber*)unitinfo;
+            struct hydra_filter filter = { 0 };
+            if (len > 0 && data != NULL)
+            {
+                if (len != sizeof(struct hydra_filter))
+                {
+                    error = EINVAL;
+                    break;
+                }
+                bcopy(data, &filter, sizeof(struct hydra_filter));
+            }
+            lck_mtx_lock(g_subscribers_lock);
+            subscriber->filter = filter;
+            lck_mtx_unlock(g_subscribers_lock);
+            break;
+        }
+        case SET_VERDICT:
+        {
+            struct subscriber *subscriber = (struct subscriber*)unitinfo;
+            struct hydra_verdict verdict;
+            if (len != sizeof(struct hydra_verdict) || data == NULL)
+            {
+                error = EINVAL;
+                break;
+            }
+            // a release skips suspension and notification, only the one resuming processes decides that
+            if (!subscriber->handler)
+            {
+                error = EPERM;
+                break;
+            }
+            bcopy(data, &verdict, sizeof(struct hydra_verdict));
+            if (verdict.verdict > VERDICT_NOTIFY || verdict.identity.fileid == 0)
+            {
+                error = EINVAL;
+                break;
+            }
+            verdict_cache_set(&verdict);
+            break;
+        }
+        case SET_VERDICT_CACHE:
+        {
+            struct subscriber *subscriber = (struct subscriber*)unitinfo;
+            uint32_t enable = 0;
+            if (len != sizeof(uint32_t) || data == NULL)
+            {
+                error = EINVAL;
+                break;
+            }
+            if (!subscriber->handler)
+            {
+                error = EPERM;
+                break;
+            }
+            bcopy(data, &enable, sizeof(uint32_t));
+            verdict_cache_enable(enable != 0);
+            break;
+        }
+        case RESUMED:
+        {
+            struct subscriber *subscriber = (struct subscriber*)unitinfo;
+            uint32_t count = 0;
+            if (len != sizeof(uint32_t) || data == NULL)
+            {
+                error = EINVAL;
+                break;
+            }
+            if (!subscriber->handler)
+            {
+                error = EPERM;
+                break;
+            }
+            bcopy(data, &count, sizeof(uint32_t));
+            suspensions_resumed(count);
+            // catching up doesn't have to wait for the next exec
+            update_degraded_mode();
+            break;
+        }
+        case SET_DEGRADE:
+        {
+            struct hydra_degrade_config config;
+            if (len != sizeof(struct hydra_degrade_config) || data == NULL)
+            {
+                error = EINVAL;
+                break;
+            }
+            bcopy(data, &config, sizeof(struct hydra_degrade_config));
+            if ((config.suspended_high != 0 && config.suspended_low >= config.suspended_high) ||
+                (config.queue_high != 0 && config.queue_low >= config.queue_high))
+            {
+                error = EINVAL;
+                break;
+            }
+            lck_mtx_lock(g_subscribers_lock);
+            g_degrade_config = config;
+            lck_mtx_unlock(g_subscribers_lock);
+            if (config.suspended_high == 0 && config.queue_high == 0)
+            {
+                set_degraded_mode(0);
+            }
+            else
+            {
+                update_degraded_mode();
+            }
+            break;
+        }
+        case SET_BATCH:
+        {
+            struct hydra_batch_config config;
+            if (len != sizeof(struct hydra_batch_config) || data == NULL)
+            {
+                error = EINVAL;
+                break;
+            }
+            bcopy(data, &config, sizeof(struct hydra_batch_config));
+            // a suspended process waits for the whole delay, keep it well under a second
+            if (config.max_delay > 100000)
+            {
+                error = EINVAL;
+                break;
+            }
+            event_batch_configure(&config);
+            break;
+        }
+        case SET_RING:
+        {
+            struct subscriber *subscriber = (struct subscriber*)unitinfo;
+            struct hydra_ring_spec spec = { 0 };
+            if (len != sizeof(struct hydra_ring_spec) || data == NULL)
+            {
+                error = EINVAL;
+                break;
+            }
+            bcopy(data, &spec, sizeof(struct hydra_ring_spec));
+            lck_mtx_lock(g_subscribers_lock);
+            if (spec.address == 0)
+            {
+                unmap_user_ring(subscriber);
+            }
+            else if (map_user_ring(subscriber, &spec) != KERN_SUCCESS)
+            {
+                error = EINVAL;
+            }
+            lck_mtx_unlock(g_subscribers_lock);
+            break;
+        }
         default:
             error = ENOTSUP;
             break;
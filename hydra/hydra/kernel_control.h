@@ -59,9 +59,21 @@
 
 #include <mach/mach_types.h>
 #include <sys/types.h>
+#include <kern/locks.h>
+
+#include "shared_data.h"
 
 kern_return_t start_kern_control(void);
 kern_return_t stop_kern_control(void);
-kern_return_t queue_userland_data(pid_t pid);
+kern_return_t queue_userland_data(struct hydra_event *event);
+boolean_t handler_accepts(struct hydra_event *event);
+boolean_t handler_behind(struct hydra_event *event);
+void suspension_queued(void);
+int targets_read_lock(void);
+void targets_read_unlock(int cookie);
+
+// held shared while reading the targets table, exclusive to change it
+// the exec hook uses targets_read_lock() instead so execs don't share a lock word
+extern lck_rw_t *g_targets_lock;
 
 #endif
@@ -64,25 +64,160 @@
 #include <sys/attr.h>
 #include <mach-o/nlist.h>
 #include <mach-o/loader.h>
+#include <mach-o/fat.h>
+#include <libkern/OSByteOrder.h>
+#include <libkern/version.h>
 
 #include "proc.h"
 #include "idt.h"
+#include "kernelcache.h"
 
-static int get_kernel_mach_header(void *buffer, vnode_t kernel_vnode);
+// systems without an uncompressed /mach_kernel still have this one
+#define KERNELCACHE_PATH "/System/Library/Caches/com.apple.kext.caches/Startup/kernelcache"
+
+// older SDKs only know the 32 bit fat header
+#ifndef FAT_MAGIC_64
+#define FAT_MAGIC_64 0xcafebabf
+struct fat_arch_64
+{
+    cpu_type_t cputype;
+    cpu_subtype_t cpusubtype;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t align;
+    uint32_t reserved;
+};
+#endif
+
+static int get_kernel_mach_header(void *buffer, vnode_t kernel_vnode, uint64_t offset);
+static int get_kernel_slice(void *buffer, uint64_t *slice_offset);
+static int add_slice_offset(kernel_info_t kernel_info, uint64_t slice_offset);
 static int process_mach_header(void *kernel_header, kernel_info_t kernel_info);
+static int validate_symbol_table(kernel_info_t kernel_info);
+static kern_return_t init_kernel_info_from_memory(kernel_info_t kernel_info);
+static kern_return_t init_kernel_info_from_disk(kernel_info_t kernel_info);
+static kern_return_t init_kernel_info_from_kernelcache(kernel_info_t kernel_info);
 static int get_kernel_linkedit(vnode_t kernel_vnode, kernel_info_t kernel_info);
 static mach_vm_address_t calculate_int80address(const mach_vm_address_t idt_address);
+static mach_vm_address_t get_running_kernel_base(void);
 static mach_vm_address_t get_running_text_address(void);
 static mach_vm_address_t find_kernel_base(const mach_vm_address_t int80_address);
 
 #pragma mark Public functions
 
 /*
- * entrypoint function to read necessary information from running kernel and kernel at disk
- * such as kaslr slide, linkedit location
+ * entrypoint function to find the kaslr slide and where the kernel symbols are
+ * the running kernel's own symbol table is used if it's still there, else /mach_kernel is read from disk
+ * and if that isn't available the symbols are extracted from the compressed kernelcache
  */
 kern_return_t
 init_kernel_info(kernel_info_t kernel_info)
+{
+    if (init_kernel_info_from_memory(kernel_info) == KERN_SUCCESS)
+    {
+        return KERN_SUCCESS;
+    }
+#if DEBUG
+    LOG_MSG("[DEBUG] Running kernel symbol table not available, reading /mach_kernel\n");
+#endif
+    if (init_kernel_info_from_disk(kernel_info) == KERN_SUCCESS)
+    {
+        return KERN_SUCCESS;
+    }
+    return init_kernel_info_from_kernelcache(kernel_info);
+}
+
+/*
+ * function to solve a kernel symbol
+ */
+mach_vm_address_t
+solve_kernel_symbol(kernel_info_t kernel_info, char *symbol_to_solve)
+{
+    struct nlist_64 *nlist = NULL;
+    kernel_info_t ki = kernel_info;
+    
+    if (ki == NULL || ki->linkedit_buf == NULL)
+    {
+        LOG_MSG("[ERROR] Kernel info struct is NULL or no linkedit buffer available!\n");
+        return 0;
+    }
+
+    mach_vm_address_t symbol_offset = ki->symboltable_fileoffset - ki->linkedit_fileoffset;
+    mach_vm_address_t string_offset = ki->stringtable_fileoffset - ki->linkedit_fileoffset;
+
+    for (int i = 0; i < ki->symboltable_nr_symbols; i++)
+    {
+        nlist = (struct nlist_64*)((char*)ki->linkedit_buf + symbol_offset + i * sizeof(struct nlist_64));
+        if (nlist->n_un.n_strx >= ki->stringtable_size)
+        {
+            continue;
+        }
+        char *symbol_string = ((char*)ki->linkedit_buf + string_offset + nlist->n_un.n_strx);
+        // find if symbol matches, it must be an exact match else _task_suspend could match _task_suspend_internal
+        if (strcmp(symbol_to_solve, symbol_string) == 0)
+        {
+#if DEBUG
+            LOG_MSG("[DEBUG] found kernel symbol %s at %p\n", symbol_to_solve, (void*)nlist->n_value);
+#endif
+            return (nlist->n_value + ki->kaslr_slide);
+        }
+    }
+    return 0;
+}
+
+#pragma Local functions to locate the symbol table
+
+/*
+ * use the symbol table of the running kernel, no disk reads and no copy of __LINKEDIT
+ * the running header already has the slid addresses so it tells where __LINKEDIT is
+ * but not the slide itself, that comes from the header address against its own symbol
+ */
+static kern_return_t
+init_kernel_info_from_memory(kernel_info_t kernel_info)
+{
+    // only Lion and Mountain Lion are known to keep the kernel __LINKEDIT after boot
+    // reading it where it was freed would be a page fault
+    if (version_major != 11 && version_major != 12)
+    {
+        return KERN_FAILURE;
+    }
+    mach_vm_address_t kernel_base = get_running_kernel_base();
+    if (kernel_base == 0)
+    {
+        return KERN_FAILURE;
+    }
+    struct kernel_info ki = {0};
+    if (process_mach_header((void*)kernel_base, &ki) ||
+        ki.linkedit_vmaddr == 0 ||
+        validate_symbol_table(&ki))
+    {
+        return KERN_FAILURE;
+    }
+    // symbol and string offsets are relative to __LINKEDIT the same way as in the file
+    ki.linkedit_buf = (void*)ki.linkedit_vmaddr;
+    ki.linkedit_in_memory = TRUE;
+    ki.running_text_addr = ki.disk_text_addr;
+    ki.kaslr_slide = 0;
+    mach_vm_address_t header_symbol = solve_kernel_symbol(&ki, "__mh_execute_header");
+    if (header_symbol == 0)
+    {
+        return KERN_FAILURE;
+    }
+    ki.kaslr_slide = kernel_base - header_symbol;
+    ki.disk_text_addr = ki.running_text_addr - ki.kaslr_slide;
+#if DEBUG
+    LOG_MSG("[DEBUG] Using running kernel symbol table at %p, kernel aslr slide is %llx\n", ki.linkedit_buf, ki.kaslr_slide);
+#endif
+    *kernel_info = ki;
+    return KERN_SUCCESS;
+}
+
+/*
+ * read necessary information from running kernel and kernel at disk
+ * such as kaslr slide, linkedit location
+ */
+static kern_return_t
+init_kernel_info_from_disk(kernel_info_t kernel_info)
 {
     kern_return_t error = 0;
     // lookup vnode for /mach_kernel
@@ -102,8 +237,14 @@ init_kernel_info(kernel_info_t kernel_info)
         goto failure;
     }
     // read and process kernel header from filesystem
-    if (get_kernel_mach_header(kernel_header, kernel_vnode) ||
-        process_mach_header(kernel_header, kernel_info))
+    // with a fat image only the x86_64 slice header is read and all file offsets are moved into it
+    uint64_t slice_offset = 0;
+    if (get_kernel_mach_header(kernel_header, kernel_vnode, 0) ||
+        get_kernel_slice(kernel_header, &slice_offset) ||
+        (slice_offset != 0 && get_kernel_mach_header(kernel_header, kernel_vnode, slice_offset)) ||
+        process_mach_header(kernel_header, kernel_info) ||
+        add_slice_offset(kernel_info, slice_offset) ||
+        validate_symbol_table(kernel_info))
     {
         goto failure;
     }
@@ -116,6 +257,7 @@ init_kernel_info(kernel_info_t kernel_info)
     // we know the location of linkedit and offsets into symbols and their strings
     // now we need to read linkedit into a buffer so we can process it
     // __LINKEDIT total size is around 1MB
+    kernel_info->linkedit_in_memory = FALSE;
     kernel_info->linkedit_buf = _MALLOC(kernel_info->linkedit_size, 1, M_ZERO);
     if (kernel_info->linkedit_buf == NULL)
     {
@@ -138,56 +280,94 @@ failure:
     {
         _FREE(kernel_header, M_ZERO);
     }
+    // the kernelcache is tried next and allocates its own
+    if (kernel_info->linkedit_buf != NULL && !kernel_info->linkedit_in_memory)
+    {
+        _FREE(kernel_info->linkedit_buf, M_ZERO);
+        kernel_info->linkedit_buf = NULL;
+    }
     vnode_put(kernel_vnode);
     return KERN_FAILURE;
 }
 
 /*
- * function to solve a kernel symbol
+ * same as the disk version but for the prelinked kernel inside the compressed kernelcache
+ * the stream only decompresses forward so the header is parsed first and then only the
+ * range holding the symbol and string tables is kept, everything else is dropped as it goes
  */
-mach_vm_address_t
-solve_kernel_symbol(kernel_info_t kernel_info, char *symbol_to_solve)
+static kern_return_t
+init_kernel_info_from_kernelcache(kernel_info_t kernel_info)
 {
-    struct nlist_64 *nlist = NULL;
-    kernel_info_t ki = kernel_info;
-    
-    if (ki == NULL || ki->linkedit_buf == NULL)
+    vnode_t kernel_vnode = NULLVP;
+    if (vnode_lookup(KERNELCACHE_PATH, 0, &kernel_vnode, NULL))
     {
-        LOG_MSG("[ERROR] Kernel info struct is NULL or no linkedit buffer available!\n");
-        return 0;
+        LOG_MSG("[ERROR] Kernelcache vnode lookup failed!\n");
+        return KERN_FAILURE;
     }
-
-    mach_vm_address_t symbol_offset = ki->symboltable_fileoffset - ki->linkedit_fileoffset;
-    mach_vm_address_t string_offset = ki->stringtable_fileoffset - ki->linkedit_fileoffset;
-
-    for (int i = 0; i < ki->symboltable_nr_symbols; i++)
+    kernelcache_stream_t stream = kernelcache_open(kernel_vnode);
+    void *kernel_header = _MALLOC(PAGE_SIZE_64, 1, M_ZERO);
+    if (stream == NULL || kernel_header == NULL)
     {
-        nlist = (struct nlist_64*)((char*)ki->linkedit_buf + symbol_offset + i * sizeof(struct nlist_64));
-        char *symbol_string = ((char*)ki->linkedit_buf + string_offset + nlist->n_un.n_strx);
-        // find if symbol matches
-        if (strncasecmp(symbol_to_solve, symbol_string, strlen(symbol_to_solve)) == 0)
-        {
+        goto failure;
+    }
+    if (kernelcache_read(stream, 0, kernel_header, PAGE_SIZE_64) ||
+        process_mach_header(kernel_header, kernel_info) ||
+        validate_symbol_table(kernel_info))
+    {
+        goto failure;
+    }
+    // shrink __LINKEDIT to what solve_kernel_symbol() reads
+    uint64_t symbols_start = kernel_info->symboltable_fileoffset;
+    uint64_t symbols_end = symbols_start + (uint64_t)kernel_info->symboltable_nr_symbols * sizeof(struct nlist_64);
+    uint64_t strings_start = kernel_info->stringtable_fileoffset;
+    uint64_t strings_end = strings_start + kernel_info->stringtable_size;
+    uint64_t start = symbols_start < strings_start ? symbols_start : strings_start;
+    uint64_t end = symbols_end > strings_end ? symbols_end : strings_end;
+    kernel_info->linkedit_fileoffset = start;
+    kernel_info->linkedit_size = end - start;
+    kernel_info->linkedit_in_memory = FALSE;
+    kernel_info->linkedit_buf = _MALLOC(kernel_info->linkedit_size, 1, M_ZERO);
+    if (kernel_info->linkedit_buf == NULL)
+    {
+        LOG_MSG("[ERROR] Failed to allocate memory for linkedit buffer!\n");
+        goto failure;
+    }
+    if (kernelcache_read(stream, start, kernel_info->linkedit_buf, kernel_info->linkedit_size))
+    {
+        _FREE(kernel_info->linkedit_buf, M_ZERO);
+        kernel_info->linkedit_buf = NULL;
+        goto failure;
+    }
+    kernel_info->running_text_addr = get_running_text_address();
+    kernel_info->kaslr_slide = kernel_info->running_text_addr - kernel_info->disk_text_addr;
 #if DEBUG
-            LOG_MSG("[DEBUG] found kernel symbol %s at %p\n", symbol_to_solve, (void*)nlist->n_value);
+    LOG_MSG("[DEBUG] Using kernelcache symbol table, kernel aslr slide is %llx\n", kernel_info->kaslr_slide);
 #endif
-            return (nlist->n_value + ki->kaslr_slide);
-        }
+    _FREE(kernel_header, M_ZERO);
+    kernelcache_close(stream);
+    vnode_put(kernel_vnode);
+    return KERN_SUCCESS;
+
+failure:
+    if (kernel_header != NULL)
+    {
+        _FREE(kernel_header, M_ZERO);
     }
-    return 0;
+    kernelcache_close(stream);
+    vnode_put(kernel_vnode);
+    return KERN_FAILURE;
 }
 
 #pragma Local functions to get data from filesystem /mach_kernel
 
 /*
- * retrieve the first page of kernel binary at disk into input buffer
- * XXX: only ready for Mountain Lion since it assumes kernel image is non-fat
- *      not hard to make it compatible with fat images
+ * retrieve the page of kernel binary at disk starting at offset into input buffer
  */
 static int
-get_kernel_mach_header(void *buffer, vnode_t kernel_vnode)
+get_kernel_mach_header(void *buffer, vnode_t kernel_vnode, uint64_t offset)
 {
     int error = KERN_SUCCESS;
-    uio_t uio = uio_create(1, 0, UIO_SYSSPACE, UIO_READ);
+    uio_t uio = uio_create(1, offset, UIO_SYSSPACE, UIO_READ);
     if (uio == NULL)
     {
         LOG_MSG("[ERROR] uio_create returned null!\n");
@@ -251,6 +431,85 @@ get_kernel_linkedit(vnode_t kernel_vnode, kernel_info_t kernel_info)
 
 #pragma Local functions to read kernel Mach-O header
 
+/*
+ * find where the x86_64 image starts, 0 if the kernel at disk isn't fat
+ * fat headers are always big endian
+ */
+static int
+get_kernel_slice(void *buffer, uint64_t *slice_offset)
+{
+    struct fat_header *fat_header = (struct fat_header*)buffer;
+    uint32_t magic = OSSwapBigToHostInt32(fat_header->magic);
+    *slice_offset = 0;
+    if (magic != FAT_MAGIC && magic != FAT_MAGIC_64)
+    {
+        return KERN_SUCCESS;
+    }
+    uint32_t nfat_arch = OSSwapBigToHostInt32(fat_header->nfat_arch);
+    size_t arch_size = magic == FAT_MAGIC ? sizeof(struct fat_arch) : sizeof(struct fat_arch_64);
+    // the header page is all we have, the arch table must fit there
+    if (nfat_arch > (PAGE_SIZE_64 - sizeof(struct fat_header)) / arch_size)
+    {
+        LOG_MSG("[ERROR] Kernel fat header is corrupted!\n");
+        return KERN_FAILURE;
+    }
+    char *arch_addr = (char*)buffer + sizeof(struct fat_header);
+    for (uint32_t i = 0; i < nfat_arch; i++)
+    {
+        if (magic == FAT_MAGIC)
+        {
+            struct fat_arch *arch = (struct fat_arch*)arch_addr;
+            if (OSSwapBigToHostInt32(arch->cputype) == CPU_TYPE_X86_64)
+            {
+                *slice_offset = OSSwapBigToHostInt32(arch->offset);
+                break;
+            }
+        }
+        else
+        {
+            struct fat_arch_64 *arch = (struct fat_arch_64*)arch_addr;
+            if (OSSwapBigToHostInt32(arch->cputype) == CPU_TYPE_X86_64)
+            {
+                *slice_offset = OSSwapBigToHostInt64(arch->offset);
+                break;
+            }
+        }
+        arch_addr += arch_size;
+    }
+    if (*slice_offset == 0)
+    {
+        LOG_MSG("[ERROR] No x86_64 slice in kernel fat image!\n");
+        return KERN_FAILURE;
+    }
+#if DEBUG
+    LOG_MSG("[DEBUG] Kernel x86_64 slice at offset %llx\n", *slice_offset);
+#endif
+    return KERN_SUCCESS;
+}
+
+/*
+ * the load commands offsets are relative to the slice, make them file offsets
+ */
+static int
+add_slice_offset(kernel_info_t kernel_info, uint64_t slice_offset)
+{
+    if (slice_offset == 0)
+    {
+        return KERN_SUCCESS;
+    }
+    // symbol and string tables offsets are only 32 bits
+    if (kernel_info->symboltable_fileoffset + slice_offset > UINT32_MAX ||
+        kernel_info->stringtable_fileoffset + slice_offset > UINT32_MAX)
+    {
+        LOG_MSG("[ERROR] Kernel slice offset is too big!\n");
+        return KERN_FAILURE;
+    }
+    kernel_info->linkedit_fileoffset    += slice_offset;
+    kernel_info->symboltable_fileoffset += (uint32_t)slice_offset;
+    kernel_info->stringtable_fileoffset += (uint32_t)slice_offset;
+    return KERN_SUCCESS;
+}
+
 /*
  * retrieve necessary information from the kernel at disk
  */
@@ -260,6 +519,12 @@ process_mach_header(void *kernel_header, kernel_info_t kernel_info)
     // now we can iterate over the kernel headers
     struct mach_header_64 *mh = (struct mach_header_64*)kernel_header;
     struct load_command *load_cmd = NULL;
+    // anything else would be parsed as garbage, including a fat header
+    if (mh->magic != MH_MAGIC_64)
+    {
+        LOG_MSG("[ERROR] Kernel header is not a 64 bits mach-o!\n");
+        return KERN_FAILURE;
+    }
     // point to the first load command
     char *load_cmd_addr = (char*)kernel_header + sizeof(struct mach_header_64);
     // iterate over all load cmds and retrieve required info to solve symbols
@@ -277,6 +542,7 @@ process_mach_header(void *kernel_header, kernel_info_t kernel_info)
             }
             else if (strncmp(seg_cmd->segname, "__LINKEDIT", 16) == 0)
             {
+                kernel_info->linkedit_vmaddr     = seg_cmd->vmaddr;
                 kernel_info->linkedit_fileoffset = seg_cmd->fileoff;
                 kernel_info->linkedit_size       = seg_cmd->filesize;
             }
@@ -294,13 +560,34 @@ process_mach_header(void *kernel_header, kernel_info_t kernel_info)
     return KERN_SUCCESS;
 }
 
+/*
+ * make sure the symbol and string tables are inside __LINKEDIT before we read them
+ */
+static int
+validate_symbol_table(kernel_info_t kernel_info)
+{
+    uint64_t linkedit_start = kernel_info->linkedit_fileoffset;
+    uint64_t linkedit_end = linkedit_start + kernel_info->linkedit_size;
+    uint64_t symbols_end = (uint64_t)kernel_info->symboltable_fileoffset + (uint64_t)kernel_info->symboltable_nr_symbols * sizeof(struct nlist_64);
+    uint64_t strings_end = (uint64_t)kernel_info->stringtable_fileoffset + kernel_info->stringtable_size;
+    if (kernel_info->linkedit_size == 0 ||
+        kernel_info->symboltable_nr_symbols == 0 ||
+        kernel_info->symboltable_fileoffset < linkedit_start || symbols_end > linkedit_end ||
+        kernel_info->stringtable_fileoffset < linkedit_start || strings_end > linkedit_end)
+    {
+        LOG_MSG("[ERROR] Kernel symbol table is not inside __LINKEDIT!\n");
+        return KERN_FAILURE;
+    }
+    return KERN_SUCCESS;
+}
+
 #pragma Local functions to find address of running kernel and find kernel ASLR slide
 
 /*
- * retrieve the __TEXT address of current loaded kernel so we can compute the KASLR slide
+ * retrieve the address of the mach-o header of current loaded kernel
  */
 static mach_vm_address_t
-get_running_text_address(void)
+get_running_kernel_base(void)
 {
     // retrieves the address of the IDT
     mach_vm_address_t idt_address = 0;
@@ -308,7 +595,16 @@ get_running_text_address(void)
     // calculate the address of the int80 handler
     mach_vm_address_t int80_address = calculate_int80address(idt_address);
     // search backwards for the kernel base address (mach-o header)
-    mach_vm_address_t kernel_base = find_kernel_base(int80_address);
+    return find_kernel_base(int80_address);
+}
+
+/*
+ * retrieve the __TEXT address of current loaded kernel so we can compute the KASLR slide
+ */
+static mach_vm_address_t
+get_running_text_address(void)
+{
+    mach_vm_address_t kernel_base = get_running_kernel_base();
     // get the vm address of __TEXT segment
     if (kernel_base != 0)
     {
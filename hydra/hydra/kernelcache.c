@@ -0,0 +1,234 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * kernelcache.c
+ *
+ * Streaming decompression of the compressed kernelcache container
+ *
+ * Reads are forward only and decompress straight into the caller's buffer, whatever
+ * comes before the requested offset is decompressed and dropped so the whole image
+ * is never in memory, only the input chunk and the LZSS window.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "kernelcache.h"
+
+#include <sys/param.h>
+#include <sys/malloc.h>
+#include <sys/systm.h>
+#include <string.h>
+#include <libkern/OSByteOrder.h>
+
+#include "my_data_definitions.h"
+#include "lzss.h"
+
+#define KERNELCACHE_SIGNATURE   0x636f6d70  // 'comp'
+#define KERNELCACHE_LZSS        0x6c7a7373  // 'lzss'
+#define KERNELCACHE_LZVN        0x6c7a766e  // 'lzvn'
+// compressed data is read from disk in chunks of this size
+#define KERNELCACHE_CHUNK       (64 * 1024)
+
+// container header, all fields are big endian
+struct compressed_kernel_header
+{
+    uint32_t signature;
+    uint32_t compress_type;
+    uint32_t adler32;
+    uint32_t uncompressed_size;
+    uint32_t compressed_size;
+    uint32_t reserved[11];
+    uint8_t  platform_name[64];
+    uint8_t  root_path[256];
+};
+
+struct kernelcache_stream
+{
+    vnode_t vnode;
+    uint8_t *input;                 // compressed chunk read from disk
+    uint64_t file_offset;           // next compressed byte to read from disk
+    uint64_t file_end;
+    uint64_t output_size;
+    struct lzss_stream lzss;
+};
+
+static int read_file(vnode_t vnode, uint64_t offset, void *buffer, uint64_t size);
+static int read_compressed(void *context, uint8_t *buffer, uint32_t size);
+
+#pragma mark Public functions
+
+/*
+ * start a decompression stream if the vnode is a compressed kernelcache we know how to read
+ * the adler32 of the container isn't verified since the image is never fully decompressed
+ */
+kernelcache_stream_t
+kernelcache_open(vnode_t kernel_vnode)
+{
+    struct compressed_kernel_header header = {0};
+    if (read_file(kernel_vnode, 0, &header, sizeof(header)))
+    {
+        return NULL;
+    }
+    if (OSSwapBigToHostInt32(header.signature) != KERNELCACHE_SIGNATURE)
+    {
+        return NULL;
+    }
+    uint32_t compress_type = OSSwapBigToHostInt32(header.compress_type);
+    // LZVN kernelcaches only exist after Mountain Lion
+    if (compress_type != KERNELCACHE_LZSS)
+    {
+        LOG_MSG("[ERROR] Unsupported kernelcache compression %s!\n", compress_type == KERNELCACHE_LZVN ? "lzvn" : "type");
+        return NULL;
+    }
+    struct kernelcache_stream *stream = _MALLOC(sizeof(struct kernelcache_stream), 1, M_ZERO);
+    if (stream == NULL)
+    {
+        LOG_MSG("[ERROR] Failed to allocate memory for kernelcache stream!\n");
+        return NULL;
+    }
+    stream->input = _MALLOC(KERNELCACHE_CHUNK, 1, M_ZERO);
+    if (stream->input == NULL)
+    {
+        LOG_MSG("[ERROR] Failed to allocate memory for kernelcache input!\n");
+        _FREE(stream, M_ZERO);
+        return NULL;
+    }
+    stream->vnode = kernel_vnode;
+    stream->file_offset = sizeof(struct compressed_kernel_header);
+    stream->file_end = stream->file_offset + OSSwapBigToHostInt32(header.compressed_size);
+    stream->output_size = OSSwapBigToHostInt32(header.uncompressed_size);
+    lzss_init(&stream->lzss, read_compressed, stream, stream->input, KERNELCACHE_CHUNK);
+    return stream;
+}
+
+/*
+ * decompress size bytes at offset of the uncompressed image into buffer
+ * offset can't be behind what was already read
+ */
+int
+kernelcache_read(kernelcache_stream_t stream, uint64_t offset, void *buffer, uint64_t size)
+{
+    if (offset < stream->lzss.output_pos || offset + size > stream->output_size)
+    {
+        LOG_MSG("[ERROR] Kernelcache read out of order or past the end!\n");
+        return KERN_FAILURE;
+    }
+    // skip whatever is before the data we want
+    if (lzss_skip(&stream->lzss, offset - stream->lzss.output_pos) ||
+        lzss_read(&stream->lzss, buffer, size))
+    {
+        LOG_MSG("[ERROR] Kernelcache compressed data is truncated!\n");
+        return KERN_FAILURE;
+    }
+    return KERN_SUCCESS;
+}
+
+void
+kernelcache_close(kernelcache_stream_t stream)
+{
+    if (stream == NULL)
+    {
+        return;
+    }
+    _FREE(stream->input, M_ZERO);
+    _FREE(stream, M_ZERO);
+}
+
+#pragma mark Local functions
+
+static int
+read_file(vnode_t vnode, uint64_t offset, void *buffer, uint64_t size)
+{
+    int error = 0;
+    uio_t uio = uio_create(1, offset, UIO_SYSSPACE, UIO_READ);
+    if (uio == NULL)
+    {
+        LOG_MSG("[ERROR] uio_create returned null!\n");
+        return KERN_FAILURE;
+    }
+    error = uio_addiov(uio, CAST_USER_ADDR_T(buffer), size);
+    if (error == 0)
+    {
+        error = VNOP_READ(vnode, uio, 0, NULL);
+    }
+    if (error == 0 && uio_resid(uio))
+    {
+        error = EINVAL;
+    }
+    uio_free(uio);
+    if (error)
+    {
+        LOG_MSG("[ERROR] Kernelcache read failed!\n");
+        return KERN_FAILURE;
+    }
+    return KERN_SUCCESS;
+}
+
+/*
+ * lzss input callback, the next chunk of the compressed data from disk
+ */
+static int
+read_compressed(void *context, uint8_t *buffer, uint32_t size)
+{
+    struct kernelcache_stream *stream = (struct kernelcache_stream*)context;
+    uint64_t left = stream->file_end - stream->file_offset;
+    uint32_t len = left > size ? size : (uint32_t)left;
+    if (len == 0)
+    {
+        return 0;
+    }
+    if (read_file(stream->vnode, stream->file_offset, buffer, len))
+    {
+        return -1;
+    }
+    stream->file_offset += len;
+    return (int)len;
+}
@@ -0,0 +1,177 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * kext_log.c
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "kext_log.h"
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <stdarg.h>
+#include <string.h>
+#include <kern/clock.h>
+
+#include "my_data_definitions.h"
+
+// power of 2
+#define LOG_RING_SIZE   64
+
+static struct hydra_log_record g_log_ring[LOG_RING_SIZE];
+static uint32_t g_log_head;         // next record to write
+static uint32_t g_log_tail;         // next record to read
+static uint64_t g_log_dropped;
+static uint64_t g_log_suppressed;
+static uint64_t g_log_window;       // one second in mach_absolute_time() units
+// only held to copy a record in or out, the message is formatted before taking it
+static lck_spin_t *g_log_lock;
+
+kern_return_t
+kext_log_init(lck_grp_t *lock_group)
+{
+    nanoseconds_to_absolutetime(NSEC_PER_SEC, &g_log_window);
+    g_log_lock = lck_spin_alloc_init(lock_group, LCK_ATTR_NULL);
+    if (g_log_lock == NULL)
+    {
+        LOG_MSG("[ERROR] Could not allocate log lock!\n");
+        return KERN_FAILURE;
+    }
+    return KERN_SUCCESS;
+}
+
+void
+kext_log_free(lck_grp_t *lock_group)
+{
+    if (g_log_lock != NULL)
+    {
+        lck_spin_free(g_log_lock, lock_group);
+        g_log_lock = NULL;
+    }
+}
+
+/*
+ * rate limit per call site and add the message to the ring, dropping it if the ring is full
+ */
+void
+kext_log(struct log_site *site, const char *format, ...)
+{
+    uint64_t now = mach_absolute_time();
+    // races between cpus only make the limit a bit fuzzy
+    if (now - site->window_start > g_log_window)
+    {
+        site->window_start = now;
+        site->emitted = 0;
+    }
+    if (site->emitted >= LOG_SITE_BURST || g_log_lock == NULL)
+    {
+        __sync_fetch_and_add(&site->suppressed, 1);
+        __sync_fetch_and_add(&g_log_suppressed, 1);
+        return;
+    }
+    site->emitted++;
+    
+    struct hydra_log_record record;
+    record.timestamp = now;
+    record.line = site->line;
+    record.suppressed = __sync_lock_test_and_set(&site->suppressed, 0);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record.message, sizeof(record.message), format, args);
+    va_end(args);
+    
+    lck_spin_lock(g_log_lock);
+    if (g_log_head - g_log_tail < LOG_RING_SIZE)
+    {
+        g_log_ring[g_log_head & (LOG_RING_SIZE - 1)] = record;
+        g_log_head++;
+    }
+    else
+    {
+        g_log_dropped++;
+    }
+    lck_spin_unlock(g_log_lock);
+}
+
+/*
+ * move as many records as fit after the header, returns the bytes used
+ */
+size_t
+kext_log_drain(struct hydra_log_header *header, size_t len)
+{
+    struct hydra_log_record *records = (struct hydra_log_record*)(header + 1);
+    size_t max_records = (len - sizeof(struct hydra_log_header)) / sizeof(struct hydra_log_record);
+    bzero(header, sizeof(struct hydra_log_header));
+    if (g_log_lock == NULL)
+    {
+        return sizeof(struct hydra_log_header);
+    }
+    // copy one record at a time so the exec path never waits for the whole drain
+    while (header->count < max_records)
+    {
+        lck_spin_lock(g_log_lock);
+        if (g_log_tail == g_log_head)
+        {
+            lck_spin_unlock(g_log_lock);
+            break;
+        }
+        records[header->count++] = g_log_ring[g_log_tail & (LOG_RING_SIZE - 1)];
+        g_log_tail++;
+        lck_spin_unlock(g_log_lock);
+    }
+    lck_spin_lock(g_log_lock);
+    header->pending = g_log_head - g_log_tail;
+    header->dropped = g_log_dropped;
+    lck_spin_unlock(g_log_lock);
+    header->suppressed = g_log_suppressed;
+    return sizeof(struct hydra_log_header) + header->count * sizeof(struct hydra_log_record);
+}
@@ -0,0 +1,154 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * latency_histogram.h
+ *
+ * Lock-free log2 bucketed histograms to measure how long targets stay suspended
+ * Shared between the kernel extension and the userland daemon so it must stay portable
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef hydra_latency_histogram_h
+#define hydra_latency_histogram_h
+
+#include <stdint.h>
+
+// bucket 0 holds zero values, bucket i holds values in [2^(i-1), 2^i)
+// values are nanoseconds so the last bucket collects everything above ~68 seconds
+#define LATENCY_HISTOGRAM_BUCKETS 38
+
+struct latency_histogram
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+};
+
+static inline uint32_t
+latency_histogram_bucket(uint64_t value)
+{
+    if (value == 0)
+    {
+        return 0;
+    }
+    uint32_t bucket = 64 - __builtin_clzll(value);
+    if (bucket >= LATENCY_HISTOGRAM_BUCKETS)
+    {
+        bucket = LATENCY_HISTOGRAM_BUCKETS - 1;
+    }
+    return bucket;
+}
+
+/*
+ * add a sample to the histogram
+ * no locks are taken so it's safe to call from the exec hook and from multiple threads
+ */
+static inline void
+latency_histogram_record(struct latency_histogram *histogram, uint64_t value)
+{
+    __sync_fetch_and_add(&histogram->buckets[latency_histogram_bucket(value)], 1);
+    __sync_fetch_and_add(&histogram->count, 1);
+    // update the max with a compare and swap loop since there's no atomic max
+    uint64_t old_max = histogram->max;
+    while (value > old_max)
+    {
+        uint64_t previous = __sync_val_compare_and_swap(&histogram->max, old_max, value);
+        if (previous == old_max)
+        {
+            break;
+        }
+        old_max = previous;
+    }
+}
+
+/*
+ * return the upper bound of the bucket containing the requested percentile
+ * percentile is expressed in permille (500 is p50, 990 is p99)
+ * the bucket counters are used instead of count because a writer might be in the middle of an update
+ */
+static inline uint64_t
+latency_histogram_percentile(const struct latency_histogram *histogram, uint32_t permille)
+{
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+    {
+        total += histogram->buckets[i];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+    // rank of the sample we are looking for, rounded up
+    uint64_t rank = (total * permille + 999) / 1000;
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t upper = (i == 0) ? 0 : (1ULL << i) - 1;
+            // the max is exact so don't report anything above it
+            if (i == LATENCY_HISTOGRAM_BUCKETS - 1 || upper > histogram->max)
+            {
+                upper = histogram->max;
+            }
+            return upper;
+        }
+    }
+    return histogram->max;
+}
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * lzss.c
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "lzss.h"
+
+#ifdef KERNEL
+#include <sys/param.h>
+#include <sys/systm.h>
+#else
+#include <string.h>
+#endif
+
+static int input_byte(struct lzss_stream *stream, uint8_t *byte);
+static int output_byte(struct lzss_stream *stream, uint8_t *byte);
+
+/*
+ * the stream only keeps the window and where it is, input reads the compressed data into buffer as it's needed
+ */
+void
+lzss_init(struct lzss_stream *stream, lzss_input_t input, void *context, uint8_t *buffer, uint32_t buffer_size)
+{
+    memset(stream, 0, sizeof(struct lzss_stream));
+    stream->input = input;
+    stream->context = context;
+    stream->buffer = buffer;
+    stream->buffer_size = buffer_size;
+    // the window starts filled with spaces and the first byte goes at N - F
+    memset(stream->window, ' ', LZSS_N - LZSS_F);
+    stream->window_pos = LZSS_N - LZSS_F;
+}
+
+/*
+ * the next size uncompressed bytes
+ * returns 0 or -1 if the input failed or ended first
+ */
+int
+lzss_read(struct lzss_stream *stream, void *output, uint64_t size)
+{
+    uint8_t *out = (uint8_t*)output;
+    for (uint64_t i = 0; i < size; i++)
+    {
+        if (output_byte(stream, &out[i]))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * same as lzss_read() but the bytes are only decoded into the window
+ */
+int
+lzss_skip(struct lzss_stream *stream, uint64_t size)
+{
+    uint8_t byte = 0;
+    for (uint64_t i = 0; i < size; i++)
+    {
+        if (output_byte(stream, &byte))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+#pragma mark Local functions
+
+/*
+ * next compressed byte, refills the buffer when it runs out
+ */
+static int
+input_byte(struct lzss_stream *stream, uint8_t *byte)
+{
+    if (stream->buffer_pos == stream->buffer_len)
+    {
+        int len = stream->input(stream->context, stream->buffer, stream->buffer_size);
+        if (len <= 0)
+        {
+            return -1;
+        }
+        stream->buffer_pos = 0;
+        stream->buffer_len = (uint32_t)len;
+    }
+    *byte = stream->buffer[stream->buffer_pos++];
+    return 0;
+}
+
+/*
+ * next uncompressed byte
+ * each flag bit says if the next item is a literal or a 12 bit position and 4 bit length into the window
+ */
+static int
+output_byte(struct lzss_stream *stream, uint8_t *byte)
+{
+    uint8_t c = 0;
+    if (stream->match_left == 0)
+    {
+        // the high byte marks how many flag bits are left
+        stream->flags >>= 1;
+        if ((stream->flags & 0x100) == 0)
+        {
+            if (input_byte(stream, &c))
+            {
+                return -1;
+            }
+            stream->flags = c | 0xFF00;
+        }
+        if (stream->flags & 1)
+        {
+            if (input_byte(stream, &c))
+            {
+                return -1;
+            }
+            goto emit;
+        }
+        uint8_t low = 0, high = 0;
+        if (input_byte(stream, &low) || input_byte(stream, &high))
+        {
+            return -1;
+        }
+        stream->match_pos = low | ((high & 0xF0) << 4);
+        stream->match_left = (high & 0x0F) + LZSS_THRESHOLD + 1;
+    }
+    c = stream->window[stream->match_pos];
+    stream->match_pos = (stream->match_pos + 1) & (LZSS_N - 1);
+    stream->match_left--;
+
+emit:
+    stream->window[stream->window_pos] = c;
+    stream->window_pos = (stream->window_pos + 1) & (LZSS_N - 1);
+    stream->output_pos++;
+    *byte = c;
+    return 0;
+}
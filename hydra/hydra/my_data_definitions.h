@@ -61,15 +61,24 @@
 #include <sys/types.h>
 #include <stdint.h>
 #include "uthash.h"
+#include "latency_histogram.h"
+#include "shared_data.h"
+#include "event_ring.h"
+#include "token_bucket.h"
 
 #define LOG_MSG(...) printf(__VA_ARGS__)
 
+// power of 2 so we can mask the cpu number, machines with more cpus will share slots
+#define MAX_CPUS    64
+
 struct kernel_info
 {
     mach_vm_address_t running_text_addr;
     mach_vm_address_t disk_text_addr;
     mach_vm_address_t kaslr_slide;
-    void *linkedit_buf;
+    void *linkedit_buf;             // the running kernel's own __LINKEDIT or a copy read from disk
+    boolean_t linkedit_in_memory;   // if TRUE linkedit_buf isn't ours to free
+    mach_vm_address_t linkedit_vmaddr;
     uint64_t linkedit_fileoffset;
     uint64_t linkedit_size;
     uint32_t symboltable_fileoffset;
@@ -82,10 +91,46 @@ typedef struct kernel_info * kernel_info_t;
 
 struct targets
 {
-    char *name;
-    UT_hash_handle hh;
+    char name[MAXCOMLEN+1];         // as the exec hook sees it, truncated
+    uint32_t id;                    // unique while the kext is loaded, never reused
+    struct hydra_target_options options;
+    struct token_bucket bucket;     // only used with a rate
+    // latencies measured from the exec hook entry, in nanoseconds
+    struct latency_histogram exec_to_suspend;
+    struct latency_histogram exec_to_enqueue;
+    struct targets *next_variant;   // same name with other match keys, only the first one is in hh
+    UT_hash_handle hh;              // by name, for the exec hook
+    UT_hash_handle hh_id;           // by id, in id order, for listings
 };
 
 typedef struct targets * targets_t;
 
+// variants of one name, the exec hook copies them to its stack to check the match keys without the lock
+#define MAX_TARGET_VARIANTS         4
+
+// max number of clients connected at the same time
+#define MAX_SUBSCRIBERS             8
+// monitors with more unread events than this are skipped
+#define MONITOR_MAX_QUEUE_DEPTH     32
+
+struct subscriber
+{
+    uint32_t unit;                  // 0 if the slot is free
+    uint32_t handler;               // this subscriber resumes the suspended processes
+    uint32_t sequence;              // sequence number of the next event
+    uint32_t capacity;              // bytes in the socket buffer, the largest free space seen
+    uint32_t queue_depth;           // unread events the last time we queued something
+    uint32_t max_queue_depth;
+    uint64_t enqueued;
+    uint64_t dropped;
+    struct hydra_filter filter;
+    // shared memory ring, only used while ring_active is set
+    // the exec path holds ring_users while it writes so the ring isn't unmapped under it
+    volatile uint32_t ring_active;
+    volatile uint32_t ring_users;
+    struct event_ring ring;
+    mach_vm_address_t ring_address; // kernel mapping
+    mach_vm_size_t ring_size;
+};
+
 #endif
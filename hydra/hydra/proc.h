@@ -42,6 +42,7 @@
 #include <sys/systm.h>
 #include <sys/kernel.h>
 #include <sys/types.h> 
+#include <sys/param.h>
 #include <sys/proc.h>
 #include <sys/sysctl.h>
 #include <sys/vnode.h>
@@ -96,6 +97,36 @@ struct lck_spin_t {
 };
 
 
+// xnu/bsd/sys/proc_internal.h
+// ML ready
+struct	session {
+	int	s_count;                    /* Ref cnt; pgrps in session. (LL) */
+	struct	proc * s_leader;        /* Session leader.(static) */
+	struct	vnode * s_ttyvp;        /* Vnode of controlling terminal.(SL) */
+	int	s_ttyvid;                   /* Vnode id of the controlling terminal (SL) */
+	struct	tty * s_ttyp;           /* Controlling terminal. (SL + ttyvp != NULL) */
+	pid_t	s_ttypgrpid;            /* tty's pgrp id */
+	pid_t	s_sid;                  /* Session ID (static) */
+	char	s_login[MAXLOGNAME];    /* Setlogin() name.(SL) */
+	int	s_flags;                    /* Session flags (s_mlock)  */
+	LIST_ENTRY(session) s_hash;     /* Hash chain.(LL) */
+	lck_mtx_t s_mlock;              /* mutex lock to protect session */
+	int	s_listflags;
+};
+
+// xnu/bsd/sys/proc_internal.h
+// ML ready
+struct	pgrp {
+	LIST_ENTRY(pgrp) pg_hash;       /* Hash chain. (LL) */
+	LIST_HEAD(, proc) pg_members;   /* Pointer to pgrp members. (PGL) */
+	struct	session * pg_session;   /* Pointer to session. (LL ) */
+	pid_t	pg_id;                  /* Pgrp id. (static) */
+	int	pg_jobc;                    /* # procs qualifying pgrp for job control (PGL) */
+	int	pg_membercnt;               /* Number of processes in the pgrocess group (PGL) */
+	int	pg_refcount;                /* number of current iterators (LL) */
+	unsigned int	pg_listflags;   /* (LL) */
+	lck_mtx_t pg_mlock;             /* mutex lock to protect pgrp */
+};
 
 // ripped from xnu/bsd/sys/proc_internal.h
 // Needed so we can access the proc structure passed to the syscall
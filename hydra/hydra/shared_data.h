@@ -59,11 +59,379 @@
 #ifndef hydra_shared_data_h
 #define hydra_shared_data_h
 
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include "latency_histogram.h"
+
+// only to build this header outside of OS X
+#ifndef MAXCOMLEN
+#define MAXCOMLEN   16
+#endif
+
 #define BUNDLE_ID   "put.as.hydra"
 
 #define ADD_APP         0
 #define REMOVE_APP      1
 #define GET_PID         2 // This isn't used anywhere
 #define REMOVE_ALL_APPS 3
+#define GET_LATENCY_STATS 4
+#define GET_HOOK_COUNTERS 5
+#define SET_HANDLER     6   // this connection resumes the suspended processes
+#define GET_SUBSCRIBERS 7
+#define SET_FILTER      8   // only receive events matching a struct hydra_filter, empty to clear
+#define SET_RING        9   // deliver events through the shared memory ring described by struct hydra_ring_spec
+#define GET_TABLE_STATE 10  // struct hydra_table_state
+#define GET_TARGETS     11  // one page of the targets table, see struct hydra_targets_page
+#define GET_POOL_STATS  12  // struct hydra_pool_stats of the targets pool
+#define GET_LOG         13  // drain the kext log, struct hydra_log_header followed by the records
+#define SET_VERDICT     14  // struct hydra_verdict, remember a decision for an executable
+#define GET_VERDICT_STATS 15 // struct hydra_verdict_stats
+#define ADD_APP_EX      16  // struct hydra_target_spec, adds the target or updates its flags
+#define RESUMED         17  // uint32_t, the handler is done with this many suspended processes
+#define SET_DEGRADE     18  // struct hydra_degrade_config
+#define GET_DEGRADE     19  // struct hydra_degrade_state
+#define SET_BATCH       20  // struct hydra_batch_config
+#define GET_BATCH_STATS 21  // struct hydra_batch_stats
+#define SET_VERDICT_CACHE 22 // uint32_t, the handler gives verdicts, off until it says so
+#define REMOVE_APP_EX   23  // struct hydra_target_spec, removes the target with the same name and match keys
+
+// event flags
+#define HYDRA_EVENT_SUSPENDED   0x1 // the process is suspended and waits for the handler
+#define HYDRA_EVENT_VERDICT     0x2 // not suspended because of a cached verdict
+#define HYDRA_EVENT_NOTIFY_ONLY 0x4 // not suspended because the target is notify only
+#define HYDRA_EVENT_DEGRADED    0x8 // not suspended because the handler is behind
+#define HYDRA_EVENT_STATE       0x10 // not a process, the degraded mode changed and HYDRA_EVENT_DEGRADED is the new mode
+#define HYDRA_EVENT_RATE_LIMITED 0x20 // not suspended because the target is over its rate
+
+/*
+ * identifies the executable file of a process, a new build of the same path gets a new mtime
+ */
+struct hydra_exec_identity
+{
+    uint64_t fsid;
+    uint64_t fileid;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+/*
+ * the record queued to userland for each suspended process
+ * timestamps are mach_absolute_time() values so the daemon can continue the timeline
+ */
+struct hydra_event
+{
+    pid_t pid;
+    uint32_t sequence;              // per connection, a gap means events were dropped
+    uint32_t flags;
+    uint32_t target_id;             // id the kernel assigned to the matched target
+    uid_t uid;
+    pid_t ppid;
+    uint32_t suppressed;            // over the rate events of this target coalesced into this one
+    uint32_t priority;              // PRIORITY_ class of the target
+    uint64_t start_time;            // process start time in microseconds, pid plus start time identify a process
+    uint64_t exec_timestamp;        // entry of the exec hook
+    uint64_t suspend_timestamp;     // after the task was suspended
+    uint64_t enqueue_timestamp;     // right before ctl_enqueuedata
+    struct hydra_exec_identity identity;
+    char name[MAXCOMLEN+1];
+};
+
+/*
+ * SET_BATCH: events for a connection that hasn't read the previous ones are held up to max_delay
+ * microseconds and sent together, a datagram is then several struct hydra_event back to back
+ * a zero delay sends each event on its own, an event with HYDRA_EVENT_SUSPENDED is never held
+ * and flushes the ones waiting before it
+ */
+#define HYDRA_BATCH_MAX     16
+
+struct hydra_batch_config
+{
+    uint32_t max_delay;             // microseconds
+    uint32_t max_events;            // sent as soon as this many are waiting, 0 is HYDRA_BATCH_MAX
+};
+
+struct hydra_batch_stats
+{
+    struct hydra_batch_config config;
+    uint64_t datagrams;             // with more than one event
+    uint64_t events;                // sent in those
+    uint64_t failures;              // events lost because their datagram couldn't be queued
+};
+
+/*
+ * SET_VERDICT: what the kernel does with the next launches of the same executable, until ttl expires
+ * or the targets change, VERDICT_NONE removes it
+ * the exec hook only reads the executable identity while the handler has SET_VERDICT_CACHE on
+ */
+#define VERDICT_NONE        0
+#define VERDICT_RELEASE     1   // don't suspend and don't notify
+#define VERDICT_NOTIFY      2   // don't suspend but still notify
+
+struct hydra_verdict
+{
+    struct hydra_exec_identity identity;
+    uint32_t verdict;
+    uint32_t ttl;                   // seconds
+};
+
+struct hydra_verdict_stats
+{
+    uint32_t entries;
+    uint32_t clears;                // the targets changed
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t expired;
+    uint64_t evictions;             // a different executable took the slot
+};
+
+/*
+ * per target kernel side latencies, in nanoseconds, returned by GET_LATENCY_STATS
+ * the kernel fills as many entries as fit in the getsockopt buffer
+ */
+struct hydra_latency_stats
+{
+    char name[MAXCOMLEN+1];
+    struct latency_histogram exec_to_suspend;
+    struct latency_histogram exec_to_enqueue;
+};
+
+
+/*
+ * per connection event filter set with SET_FILTER
+ * all the fields selected in flags must match for an event to be delivered
+ * a handler filter also restricts what gets suspended
+ */
+#define HYDRA_FILTER_TARGET     0x1
+#define HYDRA_FILTER_UID        0x2
+#define HYDRA_FILTER_PPID       0x4
+
+struct hydra_filter
+{
+    uint32_t flags;
+    uint32_t target_id;
+    uid_t uid;
+    pid_t ppid;
+};
+
+/*
+ * page aligned memory in the caller address space, the kernel maps it and writes the events there
+ * the caller should keep it wired, see event_ring.h for the layout
+ * a zero address goes back to the socket
+ */
+struct hydra_ring_spec
+{
+    uint64_t address;
+    uint64_t size;
+};
+
+// the small datagram sent when the ring goes from empty to non-empty
+#define HYDRA_RING_DOORBELL     0x48524442  // HRDB
+
+/*
+ * per connection delivery statistics returned by GET_SUBSCRIBERS
+ */
+struct hydra_subscriber_stats
+{
+    uint32_t unit;
+    uint32_t handler;
+    uint64_t enqueued;
+    uint64_t dropped;
+    uint32_t queue_depth;
+    uint32_t max_queue_depth;
+};
+
+/*
+ * occupancy of a kernel object pool, returned by GET_POOL_STATS
+ */
+struct hydra_pool_stats
+{
+    uint32_t object_size;
+    uint32_t objects_per_slab;
+    uint32_t slabs;
+    uint32_t in_use;
+    uint32_t max_in_use;
+    uint64_t allocations;
+    uint64_t failures;              // no memory for a new slab
+};
+
+/*
+ * messages logged by the kext from the exec path, returned by GET_LOG
+ * the header says how many records follow and how many messages never made it to the log
+ */
+struct hydra_log_record
+{
+    uint64_t timestamp;             // mach_absolute_time()
+    uint32_t line;                  // source line of the call site
+    uint32_t suppressed;            // messages from the same site rate limited before this one
+    char message[112];
+};
+
+struct hydra_log_header
+{
+    uint32_t count;
+    uint32_t pending;               // still in the log, call again
+    uint64_t dropped;               // log was full
+    uint64_t suppressed;            // rate limited, all sites
+};
+
+/*
+ * exec hook counters, aggregated over all cpus when read with GET_HOOK_COUNTERS
+ */
+struct hydra_hook_counters
+{
+    uint64_t execs;                 // times the hook was called
+    uint64_t fastpath_rejects;      // returned early because there are no targets
+    uint64_t table_hits;            // process name found in the targets table
+    uint64_t suspend_failures;      // _task_suspend() failed
+    uint64_t enqueue_failures;      // couldn't queue the event to userland
+    uint64_t rate_limited;          // over the target rate
+    uint64_t constraint_rejects;    // the name matched but the uid, parent or session didn't
+};
+
+/*
+ * SET_DEGRADE: while the handler is behind, matching processes are notified but not suspended
+ * it's behind once any high mark is reached and catches up when it's at or below all the low marks
+ * a zero high mark ignores that measure, all zeroes turn it off
+ */
+struct hydra_degrade_config
+{
+    uint32_t suspended_high;        // suspended processes the handler hasn't acknowledged with RESUMED
+    uint32_t suspended_low;
+    uint32_t queue_high;            // events the handler hasn't read, socket and ring
+    uint32_t queue_low;
+};
+
+struct hydra_degrade_state
+{
+    struct hydra_degrade_config config;
+    uint32_t degraded;
+    uint32_t outstanding;           // suspended and not acknowledged
+    uint32_t queue_depth;
+    uint32_t transitions;
+    uint64_t degraded_events;       // matches not suspended because of it
+};
+
+/*
+ * ADD_APP_EX, a target with options
+ * a rate limited target lets rate events per second through, with bursts of burst events, 0 means rate
+ * events over it are notified without suspending or, with TARGET_RATE_COALESCE, counted in the next one
+ * the TARGET_MATCH_ flags narrow a name match down to a user, a parent process name or a session
+ * a target is its name and match keys, the same name can be added again with other keys
+ * the first variant that matches wins and a name only variant, which matches everything, is always first
+ * priority is the PRIORITY_ class the daemon handles the events in, it's only passed along by the kernel
+ * options are uint32_t and a zero padded name so there's no padding and no garbage when they are hashed
+ */
+#define TARGET_NOTIFY_ONLY      0x1 // never suspend, only send the event
+#define TARGET_RATE_COALESCE    0x2 // drop the events over the rate, the next event has the count
+#define TARGET_MATCH_UID        0x4 // only processes of uid
+#define TARGET_MATCH_PARENT     0x8 // only processes whose parent is called parent_name
+#define TARGET_MATCH_SESSION    0x10 // only processes in session, the pid of its leader
+#define TARGET_MATCH_MASK       (TARGET_MATCH_UID | TARGET_MATCH_PARENT | TARGET_MATCH_SESSION)
+
+struct hydra_target_options
+{
+    uint32_t flags;
+    uint32_t rate;                  // events per second, 0 is unlimited
+    uint32_t burst;
+    uint32_t uid;
+    uint32_t session;
+    uint32_t priority;
+    char parent_name[20];           // MAXCOMLEN+1 rounded up, zeroes after the name
+};
+
+// priority classes, the default is 0 so targets without one are normal
+#define PRIORITY_NORMAL         0
+#define PRIORITY_INTERACTIVE    1   // someone is waiting for the window, handled first
+#define PRIORITY_BATCH          2   // tools and daemons, handled when nothing else is waiting
+#define PRIORITY_CLASSES        3
+
+struct hydra_target_spec
+{
+    char name[MAXCOMLEN+1];
+    struct hydra_target_options options;
+};
+
+/*
+ * order two targets of the same name by their match keys, 0 if they are the same target
+ * keys without their TARGET_MATCH_ flag are ignored, parent_name is zero padded on both sides
+ */
+static inline int
+hydra_target_compare_keys(const struct hydra_target_options *a, const struct hydra_target_options *b)
+{
+    uint32_t flags = a->flags & TARGET_MATCH_MASK;
+    if (flags != (b->flags & TARGET_MATCH_MASK))
+    {
+        return (flags < (b->flags & TARGET_MATCH_MASK)) ? -1 : 1;
+    }
+    if ((flags & TARGET_MATCH_UID) && a->uid != b->uid)
+    {
+        return (a->uid < b->uid) ? -1 : 1;
+    }
+    if ((flags & TARGET_MATCH_SESSION) && a->session != b->session)
+    {
+        return (a->session < b->session) ? -1 : 1;
+    }
+    if (flags & TARGET_MATCH_PARENT)
+    {
+        for (size_t i = 0; i < sizeof(a->parent_name); i++)
+        {
+            if (a->parent_name[i] != b->parent_name[i])
+            {
+                return ((uint8_t)a->parent_name[i] < (uint8_t)b->parent_name[i]) ? -1 : 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * lets the daemon know if the targets table is still what it uploaded without reading it back
+ * the generation changes with every add, update or remove, the digest only depends on the names and options
+ */
+struct hydra_table_state
+{
+    uint64_t generation;
+    uint64_t digest;
+    uint32_t count;
+};
+
+/*
+ * GET_TARGETS buffer, the caller sets cursor to 0 for the first page or to the value returned by the previous call
+ * the kernel fills it with the next cursor, 0 when there are no more, and count packed entries follow:
+ * uint32_t target id and struct hydra_target_options, unaligned, followed by the nul terminated name
+ * entries come in target id order so the listing survives changes between calls
+ */
+struct hydra_targets_page
+{
+    uint32_t cursor;
+    uint32_t count;
+};
+
+// the buffer must have room for the header and at least one entry this size
+#define HYDRA_TARGET_ENTRY_MAX  (sizeof(uint32_t) + sizeof(struct hydra_target_options) + MAXCOMLEN + 1)
+
+/*
+ * FNV-1a of a target name and options, the table digest is the XOR of all of them so the order doesn't matter
+ * both sides must hash the name truncated to MAXCOMLEN
+ */
+static inline uint64_t
+hydra_target_digest(const char *name, const struct hydra_target_options *options)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (*name != '\0')
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 0x100000001b3ULL;
+    }
+    const uint8_t *bytes = (const uint8_t*)options;
+    for (size_t i = 0; i < sizeof(struct hydra_target_options); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
 
 #endif
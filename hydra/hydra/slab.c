@@ -0,0 +1,189 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * slab.c
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "slab.h"
+
+#ifdef KERNEL
+#include <sys/param.h>
+#include <sys/malloc.h>
+#include <sys/systm.h>
+#define slab_backend_alloc(size)    _MALLOC(size, 1, M_ZERO)
+#define slab_backend_free(ptr)      _FREE(ptr, M_ZERO)
+#else
+#include <stdlib.h>
+#include <string.h>
+// the tests bring their own to make allocations fail
+#ifndef slab_backend_alloc
+#define slab_backend_alloc(size)    calloc(1, size)
+#define slab_backend_free(ptr)      free(ptr)
+#endif
+#define bzero(ptr, size)            memset(ptr, 0, size)
+#endif
+
+#define SLAB_ALIGNMENT  16
+
+struct slab
+{
+    struct slab *next;
+    size_t pad;                     // keep the objects 16 bytes aligned
+    char objects[];
+};
+
+static void add_slab_to_free_list(struct slab_pool *pool, struct slab *slab);
+
+void
+slab_pool_init(struct slab_pool *pool, size_t object_size, size_t objects_per_slab)
+{
+    bzero(pool, sizeof(struct slab_pool));
+    if (object_size < sizeof(void*))
+    {
+        object_size = sizeof(void*);
+    }
+    pool->object_size = (object_size + SLAB_ALIGNMENT - 1) & ~(size_t)(SLAB_ALIGNMENT - 1);
+    pool->objects_per_slab = objects_per_slab ? objects_per_slab : 1;
+    pool->stats.object_size = (uint32_t)pool->object_size;
+    pool->stats.objects_per_slab = (uint32_t)pool->objects_per_slab;
+}
+
+/*
+ * returns a zeroed object or NULL if a new slab was needed and couldn't be allocated
+ */
+void *
+slab_alloc(struct slab_pool *pool)
+{
+    if (pool->free_list == NULL)
+    {
+        struct slab *slab = slab_backend_alloc(sizeof(struct slab) + pool->object_size * pool->objects_per_slab);
+        if (slab == NULL)
+        {
+            pool->stats.failures++;
+            return NULL;
+        }
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->stats.slabs++;
+        add_slab_to_free_list(pool, slab);
+    }
+    void *object = pool->free_list;
+    pool->free_list = *(void**)object;
+    bzero(object, pool->object_size);
+    pool->stats.allocations++;
+    pool->stats.in_use++;
+    if (pool->stats.in_use > pool->stats.max_in_use)
+    {
+        pool->stats.max_in_use = pool->stats.in_use;
+    }
+    return object;
+}
+
+void
+slab_free(struct slab_pool *pool, void *object)
+{
+    if (object == NULL)
+    {
+        return;
+    }
+    *(void**)object = pool->free_list;
+    pool->free_list = object;
+    pool->stats.in_use--;
+}
+
+/*
+ * free every object at once, the slabs are kept for the next allocations
+ */
+void
+slab_pool_reset(struct slab_pool *pool)
+{
+    pool->free_list = NULL;
+    for (struct slab *slab = pool->slabs; slab != NULL; slab = slab->next)
+    {
+        add_slab_to_free_list(pool, slab);
+    }
+    pool->stats.in_use = 0;
+}
+
+/*
+ * give all the memory back, every object is gone
+ */
+void
+slab_pool_destroy(struct slab_pool *pool)
+{
+    struct slab *slab = pool->slabs;
+    while (slab != NULL)
+    {
+        struct slab *next = slab->next;
+        slab_backend_free(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->stats.slabs = 0;
+    pool->stats.in_use = 0;
+}
+
+/*
+ * link the objects in address order so allocations walk the slab forward
+ */
+static void
+add_slab_to_free_list(struct slab_pool *pool, struct slab *slab)
+{
+    for (size_t i = pool->objects_per_slab; i > 0; i--)
+    {
+        void *object = slab->objects + (i - 1) * pool->object_size;
+        *(void**)object = pool->free_list;
+        pool->free_list = object;
+    }
+}
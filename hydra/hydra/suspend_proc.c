@@ -63,9 +63,11 @@
 #include <string.h>
 #include <sys/attr.h>
 #include <sys/queue.h>
+#include <kern/clock.h>
 
 #include "kernel_info.h"
 #include "kernel_control.h"
+#include "verdict_cache.h"
 
 /* Status values. */
 #define	SIDL	1		/* Process being created by fork. */
@@ -79,10 +81,33 @@
 #define proc_lock(p)		lck_mtx_lock(&(p)->p_mlock)
 #define proc_unlock(p)      lck_mtx_unlock(&(p)->p_mlock)
 
-extern struct kernel_info g_kernel_info;
 extern targets_t g_targets_list;
 
+// these symbols are not exported, hydra_start() solves them before the hook is installed
 kern_return_t (*_task_suspend)(task_t target_task);
+kern_return_t (*_task_resume)(task_t target_task);
+struct session *(*_proc_session)(proc_t p);
+void (*_session_rele)(struct session *sess);
+int (*_cpu_number)(void);
+
+/*
+ * each cpu only touches its own cache line so counting doesn't bounce lines between cores
+ * the increments are still atomic because a thread can be preempted and migrated
+ * between reading the cpu number and updating the counter
+ */
+struct percpu_hook_counters
+{
+    struct hydra_hook_counters counters;
+} __attribute__((aligned(64)));
+
+static struct percpu_hook_counters g_hook_counters[MAX_CPUS];
+
+#define COUNT_HOOK_EVENT(field) __sync_fetch_and_add(&g_hook_counters[_cpu_number() & (MAX_CPUS - 1)].counters.field, 1)
+
+static void record_latency(struct latency_histogram *histogram, uint64_t start, uint64_t end);
+static void get_exec_identity(vnode_t vp, struct hydra_exec_identity *identity);
+static boolean_t constraints_match(struct hydra_target_options *options, proc_t p, uid_t uid);
+static targets_t find_target(const char *name, unsigned int name_len, unsigned int name_hash, uint32_t id);
 
 /*
  * function to replace the original proc_resetregister and suspend the processes we are interested in
@@ -90,56 +115,307 @@ kern_return_t (*_task_suspend)(task_t target_task);
 void
 myproc_resetregister(proc_t p)
 {
-    // this symbol is not exported so we need to solve it first
-    if (_task_suspend == NULL)
+    // everything the user feels as launch delay starts counting here
+    uint64_t exec_timestamp = mach_absolute_time();
+    COUNT_HOOK_EVENT(execs);
+    // nothing to match against so don't even bother to lock and lookup
+    if (g_targets_list == NULL)
     {
-        _task_suspend = (void*)(solve_kernel_symbol(&g_kernel_info, "_task_suspend"));
-        // if we can't solve the symbol then get back to the original code
-        if (_task_suspend == NULL)
-        {
-            LOG_MSG("[ERROR] Failed to solve task_suspend() symbol...\n");
-            goto original_code;
-        }
+        COUNT_HOOK_EVENT(fastpath_rejects);
+        goto original_code;
     }
     // activate proc_t lock to avoid problems
     proc_lock(p);
     // retrieve the name of the new process being executed
+    // read it straight from the proc structure since proc_name() would lookup the pid again
+    // and take the proc list lock, same logic as proc_name(): p_name is preferred over p_comm
     pid_t pid = p->p_pid;
+    uint64_t start_time = (uint64_t)p->p_start.tv_sec * 1000000ULL + p->p_start.tv_usec;
+    uid_t uid = p->p_uid;
+    pid_t ppid = p->p_ppid;
+    vnode_t textvp = p->p_textvp;
     char processname[MAXCOMLEN+1];
-    proc_name(p->p_pid, processname, sizeof(processname));
-    // try to find it on our targets list
-    targets_t temp = { 0 };
-    HASH_FIND_STR(g_targets_list, processname, temp);
+    strlcpy(processname, (p->p_name[0] != '\0') ? p->p_name : p->p_comm, sizeof(processname));
     proc_unlock(p);
+    // hash the name once and use it directly to find the bucket on our targets list
+    unsigned int name_len = (unsigned int)strlen(processname);
+    unsigned int name_hash = 0;
+    HASH_VALUE(processname, name_len, name_hash);
+    // only held to find the target and copy its variants, constraints, suspend and enqueue run without it
+    // a name only variant is always first and matches everything so nothing after it is copied
+    struct hydra_target_options variants[MAX_TARGET_VARIANTS];
+    uint32_t variant_ids[MAX_TARGET_VARIANTS];
+    int variant_count = 0;
+    int cookie = targets_read_lock();
+    targets_t temp = find_target(processname, name_len, name_hash, 0);
+    for (; temp != NULL && variant_count < MAX_TARGET_VARIANTS; temp = temp->next_variant)
+    {
+        variant_ids[variant_count] = temp->id;
+        variants[variant_count++] = temp->options;
+        if (!(temp->options.flags & TARGET_MATCH_MASK))
+        {
+            break;
+        }
+    }
+    targets_read_unlock(cookie);
+    if (variant_count == 0)
+    {
+        goto original_code;
+    }
     // found something
-    if (temp)
-    {
-        /*
-         * If posix_spawned with the START_SUSPENDED flag, stop the
-         * process before it runs.
-         */
-        /*
-         if (imgp->ip_px_sa != NULL) {
-         psa = (struct _posix_spawnattr *) imgp->ip_px_sa;
-         if (psa->psa_flags & POSIX_SPAWN_START_SUSPENDED) {
-         proc_lock(p);
-         p->p_stat = SSTOP;
-         proc_unlock(p);
-         (void) task_suspend(p->task);
-         }
-         */
+    // name only targets pay a single test for the extra keys, the first variant that matches wins
+    int variant = 0;
+    while (variant < variant_count && (variants[variant].flags & TARGET_MATCH_MASK) && !constraints_match(&variants[variant], p, uid))
+    {
+        variant++;
+    }
+    if (variant == variant_count)
+    {
+        COUNT_HOOK_EVENT(constraint_rejects);
+        goto original_code;
+    }
+    uint32_t target_id = variant_ids[variant];
+    struct hydra_target_options options = variants[variant];
+    COUNT_HOOK_EVENT(table_hits);
+    struct hydra_event event = { 0 };
+    event.pid = pid;
+    event.start_time = start_time;
+    event.target_id = target_id;
+    event.priority = options.priority;
+    event.uid = uid;
+    event.ppid = ppid;
+    event.exec_timestamp = exec_timestamp;
+    strlcpy(event.name, processname, sizeof(event.name));
+    // a known executable doesn't need to wait for the daemon again
+    // the identity costs a vnode lookup so only pay for it while the handler gives verdicts
+    uint32_t verdict = VERDICT_NONE;
+    if (verdict_cache_enabled())
+    {
+        get_exec_identity(textvp, &event.identity);
+        verdict = verdict_cache_lookup(&event.identity);
+    }
+    if (verdict == VERDICT_RELEASE)
+    {
+        goto original_code;
+    }
+    if (options.rate != 0)
+    {
+        // the bucket lives in the entry, if it was removed or replaced meanwhile the event just goes through
+        boolean_t coalesced = FALSE;
+        cookie = targets_read_lock();
+        temp = find_target(processname, name_len, name_hash, target_id);
+        if (temp != NULL && !token_bucket_take(&temp->bucket, exec_timestamp))
+        {
+            COUNT_HOOK_EVENT(rate_limited);
+            // counted and reported with the next event that gets through
+            if (temp->options.flags & TARGET_RATE_COALESCE)
+            {
+                __sync_fetch_and_add(&temp->bucket.suppressed, 1);
+                coalesced = TRUE;
+            }
+            event.flags |= HYDRA_EVENT_RATE_LIMITED;
+        }
+        else if (temp != NULL && temp->bucket.suppressed != 0)
+        {
+            event.suppressed = __sync_lock_test_and_set(&temp->bucket.suppressed, 0);
+        }
+        targets_read_unlock(cookie);
+        if (coalesced)
+        {
+            goto original_code;
+        }
+    }
+    /*
+     * If posix_spawned with the START_SUSPENDED flag, stop the
+     * process before it runs.
+     */
+    /*
+     if (imgp->ip_px_sa != NULL) {
+     psa = (struct _posix_spawnattr *) imgp->ip_px_sa;
+     if (psa->psa_flags & POSIX_SPAWN_START_SUSPENDED) {
+     proc_lock(p);
+     p->p_stat = SSTOP;
+     proc_unlock(p);
+     (void) task_suspend(p->task);
+     }
+     */
+    // without a handler wanting it nobody would resume the process so the monitors only get notified
+    if (verdict == VERDICT_NOTIFY)
+    {
+        event.flags |= HYDRA_EVENT_VERDICT;
+    }
+    else if (options.flags & TARGET_NOTIFY_ONLY)
+    {
+        event.flags |= HYDRA_EVENT_NOTIFY_ONLY;
+    }
+    else if (!(event.flags & HYDRA_EVENT_RATE_LIMITED) && handler_accepts(&event) && !handler_behind(&event))
+    {
         proc_lock(p);
         p->p_stat = SSTOP;
         proc_unlock(p);
-        if (_task_suspend(p->task) == KERN_SUCCESS)
+        if (_task_suspend(p->task) != KERN_SUCCESS)
         {
-            // queue data for userland process
-            queue_userland_data(pid);
+            COUNT_HOOK_EVENT(suspend_failures);
+            goto original_code;
         }
+        event.flags |= HYDRA_EVENT_SUSPENDED;
+        event.suspend_timestamp = mach_absolute_time();
+    }
+    // queue data for userland process
+    kern_return_t queued = queue_userland_data(&event);
+    if (queued == KERN_SUCCESS && (event.flags & HYDRA_EVENT_SUSPENDED))
+    {
+        suspension_queued();
+    }
+    else if (queued != KERN_SUCCESS && (event.flags & HYDRA_EVENT_SUSPENDED))
+    {
+        // the handler will never hear about it so nobody else would resume it
+        COUNT_HOOK_EVENT(enqueue_failures);
+        proc_lock(p);
+        p->p_stat = SRUN;
+        proc_unlock(p);
+        _task_resume(p->task);
     }
+    // the histograms live in the entry too
+    cookie = targets_read_lock();
+    temp = find_target(processname, name_len, name_hash, target_id);
+    if (temp != NULL)
+    {
+        if (event.flags & HYDRA_EVENT_SUSPENDED)
+        {
+            record_latency(&temp->exec_to_suspend, exec_timestamp, event.suspend_timestamp);
+        }
+        if (queued == KERN_SUCCESS)
+        {
+            record_latency(&temp->exec_to_enqueue, exec_timestamp, event.enqueue_timestamp);
+        }
+    }
+    targets_read_unlock(cookie);
     // the original function code
 original_code:
 	proc_lock(p);
 	p->p_lflag &= ~P_LREGISTER;
 	proc_unlock(p);
 }
+
+/*
+ * sum the counters of all cpus
+ * this is the only place where the per cpu slots are read
+ */
+void
+get_hook_counters(struct hydra_hook_counters *counters)
+{
+    bzero(counters, sizeof(struct hydra_hook_counters));
+    for (int i = 0; i < MAX_CPUS; i++)
+    {
+        struct hydra_hook_counters *cpu = &g_hook_counters[i].counters;
+        counters->execs            += cpu->execs;
+        counters->fastpath_rejects += cpu->fastpath_rejects;
+        counters->table_hits       += cpu->table_hits;
+        counters->suspend_failures += cpu->suspend_failures;
+        counters->enqueue_failures += cpu->enqueue_failures;
+        counters->rate_limited     += cpu->rate_limited;
+        counters->constraint_rejects += cpu->constraint_rejects;
+    }
+}
+
+/*
+ * find a target by its name hash, called with targets_read_lock() held
+ * if id is 0 the first variant of the name is returned, if not only the variant with that id
+ * an entry removed and added again gets a new id
+ */
+static targets_t
+find_target(const char *name, unsigned int name_len, unsigned int name_hash, uint32_t id)
+{
+    targets_t target = NULL;
+    HASH_FIND_BYHASHVALUE(hh, g_targets_list, name, name_len, name_hash, target);
+    while (target != NULL && id != 0 && target->id != id)
+    {
+        target = target->next_variant;
+    }
+    return target;
+}
+
+/*
+ * the name matched, check the rest of the target keys
+ * parent and session are only read when the target wants them and through references
+ * the parent can exit and the session go away at any time so their pointers in our proc aren't safe to follow
+ */
+static boolean_t
+constraints_match(struct hydra_target_options *options, proc_t p, uid_t uid)
+{
+    if ((options->flags & TARGET_MATCH_UID) && options->uid != uid)
+    {
+        return FALSE;
+    }
+    if (options->flags & TARGET_MATCH_PARENT)
+    {
+        // same name the hook would see if the parent was the one being executed
+        char parent_name[MAXCOMLEN+1] = { 0 };
+        proc_t parent = proc_find(proc_ppid(p));
+        if (parent == PROC_NULL)
+        {
+            return FALSE;
+        }
+        proc_lock(parent);
+        strlcpy(parent_name, (parent->p_name[0] != '\0') ? parent->p_name : parent->p_comm, sizeof(parent_name));
+        proc_unlock(parent);
+        proc_rele(parent);
+        if (strncmp(parent_name, options->parent_name, MAXCOMLEN) != 0)
+        {
+            return FALSE;
+        }
+    }
+    if (options->flags & TARGET_MATCH_SESSION)
+    {
+        // takes the proc list lock to read the session and returns it with a reference
+        struct session *session = _proc_session(p);
+        if (session == NULL)
+        {
+            return FALSE;
+        }
+        pid_t sid = session->s_sid;
+        _session_rele(session);
+        if (sid != (pid_t)options->session)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * file system, file id and modification time of the executable, zeroes if we can't get them
+ */
+static void
+get_exec_identity(vnode_t vp, struct hydra_exec_identity *identity)
+{
+    if (vp == NULLVP || vnode_getwithref(vp) != 0)
+    {
+        return;
+    }
+    struct vnode_attr va;
+    VATTR_INIT(&va);
+    VATTR_WANTED(&va, va_fsid);
+    VATTR_WANTED(&va, va_fileid);
+    VATTR_WANTED(&va, va_modify_time);
+    if (vnode_getattr(vp, &va, vfs_context_current()) == 0)
+    {
+        identity->fsid = va.va_fsid;
+        identity->fileid = va.va_fileid;
+        identity->mtime_sec = va.va_modify_time.tv_sec;
+        identity->mtime_nsec = va.va_modify_time.tv_nsec;
+    }
+    vnode_put(vp);
+}
+
+/*
+ * convert the interval to nanoseconds and add it to the target histogram
+ */
+static void
+record_latency(struct latency_histogram *histogram, uint64_t start, uint64_t end)
+{
+    uint64_t nanoseconds = 0;
+    absolutetime_to_nanoseconds(end - start, &nanoseconds);
+    latency_histogram_record(histogram, nanoseconds);
+}
@@ -58,7 +58,9 @@
 #define hydra_suspend_proc_h
 
 #include "proc.h"
+#include "shared_data.h"
 
 void myproc_resetregister(proc_t p);
+void get_hook_counters(struct hydra_hook_counters *counters);
 
 #endif
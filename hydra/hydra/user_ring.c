@@ -0,0 +1,168 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * user_ring.c
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "user_ring.h"
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/proc.h>
+#include <mach/vm_param.h>
+#include <kern/task.h>
+
+#include "event_ring.h"
+
+// these symbols are not exported, hydra_start() solves them before the hook is installed
+kern_return_t (*_mach_vm_remap)(vm_map_t target_map, mach_vm_offset_t *address, mach_vm_size_t size, mach_vm_offset_t mask, int flags, vm_map_t src_map, mach_vm_offset_t memory_address, boolean_t copy, vm_prot_t *cur_protection, vm_prot_t *max_protection, vm_inherit_t inheritance);
+kern_return_t (*_mach_vm_deallocate)(vm_map_t target, mach_vm_offset_t address, mach_vm_size_t size);
+vm_map_t (*_get_task_map)(task_t task);
+vm_map_t *_kernel_map;
+
+/*
+ * map the ring the caller allocated into the kernel map and start using it
+ * must be called from the caller context since its task map is the source
+ */
+kern_return_t
+map_user_ring(struct subscriber *subscriber, struct hydra_ring_spec *spec)
+{
+    if ((spec->address & PAGE_MASK) != 0 || (spec->size & PAGE_MASK) != 0 || event_ring_capacity((size_t)spec->size) == 0)
+    {
+        return KERN_INVALID_ARGUMENT;
+    }
+    mach_vm_offset_t kernel_address = 0;
+    vm_prot_t cur_protection = VM_PROT_NONE;
+    vm_prot_t max_protection = VM_PROT_NONE;
+    // share the pages, no copy, so both sides see the same memory
+    kern_return_t kr = _mach_vm_remap(*_kernel_map, &kernel_address, spec->size, 0, VM_FLAGS_ANYWHERE,
+                                      _get_task_map(current_task()), spec->address, FALSE,
+                                      &cur_protection, &max_protection, VM_INHERIT_NONE);
+    if (kr != KERN_SUCCESS)
+    {
+        LOG_MSG("[ERROR] Failed to map userland ring: %d\n", kr);
+        return kr;
+    }
+    struct event_ring ring = { 0 };
+    if ((cur_protection & (VM_PROT_READ | VM_PROT_WRITE)) != (VM_PROT_READ | VM_PROT_WRITE) ||
+        event_ring_attach(&ring, (void*)kernel_address, (size_t)spec->size, 0) != 0)
+    {
+        _mach_vm_deallocate(*_kernel_map, kernel_address, spec->size);
+        return KERN_INVALID_ARGUMENT;
+    }
+    // replace any ring we had before
+    unmap_user_ring(subscriber);
+    subscriber->ring = ring;
+    subscriber->ring_address = kernel_address;
+    subscriber->ring_size = spec->size;
+    __sync_synchronize();
+    subscriber->ring_active = 1;
+    return KERN_SUCCESS;
+}
+
+/*
+ * stop using the ring, wait for producers still writing to it and remove the mapping
+ */
+void
+unmap_user_ring(struct subscriber *subscriber)
+{
+    if (!subscriber->ring_active)
+    {
+        return;
+    }
+    subscriber->ring_active = 0;
+    __sync_synchronize();
+    while (subscriber->ring_users != 0)
+    {
+        struct timespec ts = { 0, 1000000 };
+        msleep((void*)&subscriber->ring_users, NULL, PUSER, "hydra_ring", &ts);
+    }
+    _mach_vm_deallocate(*_kernel_map, subscriber->ring_address, subscriber->ring_size);
+    bzero(&subscriber->ring, sizeof(struct event_ring));
+    subscriber->ring_address = 0;
+    subscriber->ring_size = 0;
+}
+
+/*
+ * called from the exec path
+ * returns -1 if there's no ring or it's full, else the result of event_ring_produce()
+ */
+int
+user_ring_produce(struct subscriber *subscriber, struct hydra_event *event)
+{
+    int result = -1;
+    // announce ourselves before looking at ring_active, unmap_user_ring() does the opposite
+    __sync_fetch_and_add(&subscriber->ring_users, 1);
+    if (subscriber->ring_active)
+    {
+        result = event_ring_produce(&subscriber->ring, event);
+    }
+    __sync_fetch_and_sub(&subscriber->ring_users, 1);
+    return result;
+}
+
+/*
+ * unread events in the ring, 0 without one
+ */
+uint32_t
+user_ring_depth(struct subscriber *subscriber)
+{
+    uint32_t depth = 0;
+    __sync_fetch_and_add(&subscriber->ring_users, 1);
+    if (subscriber->ring_active)
+    {
+        depth = (uint32_t)event_ring_depth(&subscriber->ring);
+    }
+    __sync_fetch_and_sub(&subscriber->ring_users, 1);
+    return depth;
+}
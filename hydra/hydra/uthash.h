@@ -95,6 +95,27 @@ do {
   }                                                                              \
 } while (0)
 
+/* split the hashing from the lookup so the hash of a key can be computed once and reused */
+/* all hash functions compute the bucket as hashv & (num_bkts-1) so we can derive it later */
+#define HASH_VALUE(keyptr,keylen,hashv)                                          \
+do {                                                                             \
+  unsigned _hv_bkt;                                                              \
+  HASH_FCN(keyptr,keylen,1,hashv,_hv_bkt);                                       \
+} while (0)
+
+#define HASH_FIND_BYHASHVALUE(hh,head,keyptr,keylen,hashval,out)                 \
+do {                                                                             \
+  unsigned _hf_bkt;                                                              \
+  out=NULL;                                                                      \
+  if (head) {                                                                    \
+     _hf_bkt = (hashval) & ((head)->hh.tbl->num_buckets - 1);                    \
+     if (HASH_BLOOM_TEST((head)->hh.tbl, hashval)) {                             \
+       HASH_FIND_IN_BKT((head)->hh.tbl, hh, (head)->hh.tbl->buckets[ _hf_bkt ],  \
+                        keyptr,keylen,out);                                      \
+     }                                                                           \
+  }                                                                              \
+} while (0)
+
 #ifdef HASH_BLOOM
 #define HASH_BLOOM_BITLEN (1ULL << HASH_BLOOM)
 #define HASH_BLOOM_BYTELEN (HASH_BLOOM_BITLEN/8) + ((HASH_BLOOM_BITLEN%8) ? 1:0)
@@ -0,0 +1,250 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * verdict_cache.c
+ *
+ * Decisions the daemon made for an executable so the next launches skip the round trip
+ *
+ * Direct mapped by a hash of the identity, a new entry replaces whatever was in its slot.
+ * Cleared whenever the targets change.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "verdict_cache.h"
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <string.h>
+#include <kern/clock.h>
+
+#include "my_data_definitions.h"
+
+// power of 2
+#define VERDICT_CACHE_SIZE  256
+
+struct verdict_entry
+{
+    struct hydra_exec_identity identity;
+    uint32_t verdict;               // VERDICT_NONE if the slot is free
+    uint64_t expires;               // mach_absolute_time()
+};
+
+static struct verdict_entry g_verdicts[VERDICT_CACHE_SIZE];
+static struct hydra_verdict_stats g_verdict_stats;
+// entries are copied in and out under it, nothing else
+static lck_spin_t *g_verdict_lock;
+// read without the lock so the exec path skips the cache when there's nothing to find
+static volatile uint32_t g_verdict_enabled = 0;
+static volatile uint32_t g_verdict_entries = 0;
+
+static uint32_t identity_slot(struct hydra_exec_identity *identity);
+
+kern_return_t
+verdict_cache_init(lck_grp_t *lock_group)
+{
+    g_verdict_lock = lck_spin_alloc_init(lock_group, LCK_ATTR_NULL);
+    if (g_verdict_lock == NULL)
+    {
+        LOG_MSG("[ERROR] Could not allocate verdict cache lock!\n");
+        return KERN_FAILURE;
+    }
+    return KERN_SUCCESS;
+}
+
+void
+verdict_cache_free(lck_grp_t *lock_group)
+{
+    if (g_verdict_lock != NULL)
+    {
+        lck_spin_free(g_verdict_lock, lock_group);
+        g_verdict_lock = NULL;
+    }
+}
+
+/*
+ * called from the exec path, VERDICT_NONE if there's nothing valid for this executable
+ */
+uint32_t
+verdict_cache_lookup(struct hydra_exec_identity *identity)
+{
+    // we couldn't identify the executable, all of those would look the same
+    if (g_verdict_lock == NULL || g_verdict_entries == 0 || identity->fileid == 0)
+    {
+        return VERDICT_NONE;
+    }
+    uint32_t verdict = VERDICT_NONE;
+    uint64_t now = mach_absolute_time();
+    struct verdict_entry *entry = &g_verdicts[identity_slot(identity)];
+    lck_spin_lock(g_verdict_lock);
+    if (entry->verdict != VERDICT_NONE && memcmp(&entry->identity, identity, sizeof(struct hydra_exec_identity)) == 0)
+    {
+        if (now < entry->expires)
+        {
+            verdict = entry->verdict;
+            g_verdict_stats.hits++;
+        }
+        else
+        {
+            entry->verdict = VERDICT_NONE;
+            g_verdict_entries--;
+            g_verdict_stats.expired++;
+        }
+    }
+    if (verdict == VERDICT_NONE)
+    {
+        g_verdict_stats.misses++;
+    }
+    lck_spin_unlock(g_verdict_lock);
+    return verdict;
+}
+
+/*
+ * add, replace or remove the verdict for an executable
+ */
+void
+verdict_cache_set(struct hydra_verdict *verdict)
+{
+    uint64_t ttl = 0;
+    nanoseconds_to_absolutetime((uint64_t)verdict->ttl * NSEC_PER_SEC, &ttl);
+    struct verdict_entry *entry = &g_verdicts[identity_slot(&verdict->identity)];
+    lck_spin_lock(g_verdict_lock);
+    // nobody would look it up
+    if (!g_verdict_enabled)
+    {
+        lck_spin_unlock(g_verdict_lock);
+        return;
+    }
+    if (verdict->verdict == VERDICT_NONE)
+    {
+        // only remove it if the slot holds this executable
+        if (entry->verdict != VERDICT_NONE && memcmp(&entry->identity, &verdict->identity, sizeof(struct hydra_exec_identity)) == 0)
+        {
+            entry->verdict = VERDICT_NONE;
+            g_verdict_entries--;
+        }
+    }
+    else
+    {
+        if (entry->verdict == VERDICT_NONE)
+        {
+            g_verdict_entries++;
+        }
+        else if (memcmp(&entry->identity, &verdict->identity, sizeof(struct hydra_exec_identity)) != 0)
+        {
+            g_verdict_stats.evictions++;
+        }
+        entry->identity = verdict->identity;
+        entry->verdict = verdict->verdict;
+        entry->expires = mach_absolute_time() + ttl;
+    }
+    lck_spin_unlock(g_verdict_lock);
+}
+
+void
+verdict_cache_clear(void)
+{
+    if (g_verdict_lock == NULL)
+    {
+        return;
+    }
+    lck_spin_lock(g_verdict_lock);
+    bzero(g_verdicts, sizeof(g_verdicts));
+    g_verdict_entries = 0;
+    g_verdict_stats.clears++;
+    lck_spin_unlock(g_verdict_lock);
+}
+
+void
+verdict_cache_stats(struct hydra_verdict_stats *stats)
+{
+    lck_spin_lock(g_verdict_lock);
+    *stats = g_verdict_stats;
+    stats->entries = g_verdict_entries;
+    lck_spin_unlock(g_verdict_lock);
+}
+
+/*
+ * only a handler that gives verdicts turns it on, turning it off forgets them
+ */
+void
+verdict_cache_enable(boolean_t enable)
+{
+    if (g_verdict_lock == NULL)
+    {
+        return;
+    }
+    lck_spin_lock(g_verdict_lock);
+    g_verdict_enabled = enable ? 1 : 0;
+    if (!enable)
+    {
+        bzero(g_verdicts, sizeof(g_verdicts));
+        g_verdict_entries = 0;
+    }
+    lck_spin_unlock(g_verdict_lock);
+}
+
+boolean_t
+verdict_cache_enabled(void)
+{
+    return g_verdict_enabled != 0;
+}
+
+#pragma mark Local functions
+
+static uint32_t
+identity_slot(struct hydra_exec_identity *identity)
+{
+    uint64_t hash = identity->fileid * 0x9e3779b97f4a7c15ULL;
+    hash ^= identity->fsid + (hash >> 29);
+    hash ^= (uint64_t)identity->mtime_sec * 0xbf58476d1ce4e5b9ULL;
+    return (uint32_t)(hash >> 32) & (VERDICT_CACHE_SIZE - 1);
+}
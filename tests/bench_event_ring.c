@@ -0,0 +1,179 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * bench_event_ring.c
+ *
+ * Events per second through event_ring.h against a datagram socket, the path it replaces
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "event_ring.h"
+
+#define RING_SIZE   (256 * 1024)
+#define EVENTS      1000000
+
+static struct event_ring g_ring;
+static int g_sockets[2];
+static int g_producers;
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+ring_producer(void *arg)
+{
+    struct hydra_event event;
+    memset(&event, 0, sizeof(event));
+    for (int i = 0; i < EVENTS / g_producers; i++)
+    {
+        while (event_ring_produce(&g_ring, &event) < 0)
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *
+socket_producer(void *arg)
+{
+    struct hydra_event event;
+    memset(&event, 0, sizeof(event));
+    for (int i = 0; i < EVENTS / g_producers; i++)
+    {
+        while (send(g_sockets[0], &event, sizeof(event), 0) < 0)
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static double
+run(int producers, int use_ring)
+{
+    pthread_t threads[16];
+    struct hydra_event event;
+    g_producers = producers;
+    uint64_t total = (uint64_t)(EVENTS / producers) * producers;
+    double start = now_seconds();
+    for (int i = 0; i < producers; i++)
+    {
+        pthread_create(&threads[i], NULL, use_ring ? ring_producer : socket_producer, NULL);
+    }
+    for (uint64_t received = 0; received < total; )
+    {
+        if (use_ring)
+        {
+            if (event_ring_consume(&g_ring, &event))
+            {
+                received++;
+            }
+            else
+            {
+                // the daemon would sleep until the doorbell
+                sched_yield();
+            }
+        }
+        else if (recv(g_sockets[1], &event, sizeof(event), 0) == sizeof(event))
+        {
+            received++;
+        }
+    }
+    double elapsed = now_seconds() - start;
+    for (int i = 0; i < producers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    return total / elapsed;
+}
+
+int
+main(void)
+{
+    void *memory = NULL;
+    posix_memalign(&memory, 4096, RING_SIZE);
+    if (memory == NULL || event_ring_attach(&g_ring, memory, RING_SIZE, 1) != 0)
+    {
+        fprintf(stderr, "failed to set up the ring\n");
+        return 1;
+    }
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, g_sockets) != 0)
+    {
+        perror("socketpair");
+        return 1;
+    }
+    printf("%-10s %14s %14s\n", "producers", "ring ev/s", "socket ev/s");
+    for (int producers = 1; producers <= 4; producers *= 2)
+    {
+        double ring = run(producers, 1);
+        double sock = run(producers, 0);
+        printf("%-10d %14.0f %14.0f\n", producers, ring, sock);
+    }
+    free(memory);
+    return 0;
+}
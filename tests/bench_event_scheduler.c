@@ -0,0 +1,156 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * The userland daemon to talk to the kernel and process the target apps
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * bench_event_scheduler.c
+ *
+ * Suspend to resume time per priority class through the event scheduler under a mixed load
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <mach/mach_time.h>
+
+#include "event_scheduler.h"
+#include "latency_histogram.h"
+
+#define WORKERS         2
+#define EVENTS          20000
+#define BURST           16
+// the simulated handler cost, each event keeps a worker busy about this long, bursts arrive so the workers are about 90% busy
+#define SERVICE_NS      100000ULL
+
+static struct latency_histogram g_latency[PRIORITY_CLASSES];
+static volatile uint64_t g_deadlines_missed;
+
+// the daemon metrics, only the calls the scheduler makes
+void
+metrics_deadline_missed(void)
+{
+    __sync_fetch_and_add(&g_deadlines_missed, 1);
+}
+
+void
+metrics_worker_busy(uint64_t start, uint64_t end)
+{
+}
+
+static void
+sleep_ns(uint64_t ns)
+{
+    struct timespec ts = { (time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL) };
+    nanosleep(&ts, NULL);
+}
+
+/*
+ * submission stands for the kext suspending the process and the end of the handler for the resume
+ * so the time covers the wait for a worker, which the scheduler decides, and the handler cost
+ */
+static void
+handle_event(struct hydra_event *event, uint64_t receive_timestamp)
+{
+    sleep_ns(SERVICE_NS);
+    latency_histogram_record(&g_latency[event->priority], mach_absolute_time() - receive_timestamp);
+}
+
+int
+main(void)
+{
+    // a mix of mostly normal launches, some the user waits for and some background tools
+    static const uint32_t mix[10] = {
+        PRIORITY_INTERACTIVE, PRIORITY_NORMAL, PRIORITY_BATCH, PRIORITY_NORMAL, PRIORITY_NORMAL,
+        PRIORITY_BATCH, PRIORITY_NORMAL, PRIORITY_INTERACTIVE, PRIORITY_NORMAL, PRIORITY_BATCH
+    };
+    static const char *names[PRIORITY_CLASSES] = {
+        [PRIORITY_NORMAL] = "normal", [PRIORITY_INTERACTIVE] = "interactive", [PRIORITY_BATCH] = "batch"
+    };
+    // sleeps overshoot, use what one really takes to set the load
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < 100; i++)
+    {
+        sleep_ns(SERVICE_NS);
+    }
+    uint64_t service = (mach_absolute_time() - start) / 100;
+    uint64_t burst_gap = BURST * service * 10 / 9 / WORKERS;
+    if (event_scheduler_start(WORKERS, handle_event))
+    {
+        return 1;
+    }
+    struct hydra_event event;
+    memset(&event, 0, sizeof(event));
+    for (int i = 0; i < EVENTS; i++)
+    {
+        event.pid = i;
+        event.priority = mix[i % 10];
+        event_scheduler_submit(&event, mach_absolute_time());
+        if (i % BURST == BURST - 1)
+        {
+            sleep_ns(burst_gap);
+        }
+    }
+    event_scheduler_stop();
+    printf("%d events, %d workers, %llu us per event\n", EVENTS, WORKERS, (unsigned long long)service / 1000);
+    printf("%-12s %8s %10s %10s %10s\n", "class", "events", "p50 us", "p99 us", "max us");
+    for (int i = 0; i < PRIORITY_CLASSES; i++)
+    {
+        struct latency_histogram *histogram = &g_latency[i];
+        printf("%-12s %8llu %10llu %10llu %10llu\n", names[i], (unsigned long long)histogram->count,
+               (unsigned long long)latency_histogram_percentile(histogram, 500) / 1000,
+               (unsigned long long)latency_histogram_percentile(histogram, 990) / 1000,
+               (unsigned long long)histogram->max / 1000);
+    }
+    printf("deadlines missed: %llu\n", (unsigned long long)g_deadlines_missed);
+    return 0;
+}
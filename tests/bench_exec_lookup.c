@@ -0,0 +1,240 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * bench_exec_lookup.c
+ *
+ * Cost of finding the target in the exec hook, proc_name() and HASH_FIND_STR against
+ * copying the name from the proc and HASH_FIND_BYHASHVALUE with a precomputed hash
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+// the bundled uthash allocates with the kernel functions
+#define uthash_malloc(sz)       calloc(1, sz)
+#define uthash_free(ptr, sz)    free(ptr)
+#include "uthash.h"
+#include "shared_data.h"
+
+#define TARGETS     1000
+#define PROCS       4096
+#define LOOKUPS     2000000
+
+// only what the hook reads, with the same sizes as proc.h
+struct sim_proc
+{
+    int p_pid;
+    pthread_mutex_t p_mlock;
+    char p_comm[MAXCOMLEN+1];
+    char p_name[(2*MAXCOMLEN)+1];
+    UT_hash_handle hh;              // the pid hash proc_find() and proc_name() use
+};
+
+struct target
+{
+    char name[MAXCOMLEN+1];
+    UT_hash_handle hh;
+};
+
+static struct sim_proc g_procs[PROCS];
+static struct sim_proc *g_pid_hash = NULL;
+static pthread_mutex_t g_proc_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct target g_targets[TARGETS];
+static struct target *g_targets_list = NULL;
+static volatile uint64_t g_found;
+
+static void
+copy_name(char *dst, const char *src, size_t size)
+{
+    size_t len = strnlen(src, size - 1);
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+/*
+ * what proc_name() does, find the pid again under the proc list lock and copy the name out
+ */
+static void
+sim_proc_name(int pid, char *buf, int size)
+{
+    struct sim_proc *p = NULL;
+    pthread_mutex_lock(&g_proc_list_lock);
+    HASH_FIND_INT(g_pid_hash, &pid, p);
+    if (p != NULL)
+    {
+        copy_name(buf, (p->p_name[0] != '\0') ? p->p_name : p->p_comm, size);
+    }
+    pthread_mutex_unlock(&g_proc_list_lock);
+}
+
+static struct target *
+lookup_before(struct sim_proc *p)
+{
+    char processname[MAXCOMLEN+1];
+    struct target *target = NULL;
+    pthread_mutex_lock(&p->p_mlock);
+    sim_proc_name(p->p_pid, processname, sizeof(processname));
+    pthread_mutex_unlock(&p->p_mlock);
+    HASH_FIND_STR(g_targets_list, processname, target);
+    return target;
+}
+
+static struct target *
+lookup_after(struct sim_proc *p)
+{
+    char processname[MAXCOMLEN+1];
+    struct target *target = NULL;
+    pthread_mutex_lock(&p->p_mlock);
+    copy_name(processname, (p->p_name[0] != '\0') ? p->p_name : p->p_comm, sizeof(processname));
+    pthread_mutex_unlock(&p->p_mlock);
+    unsigned int name_len = (unsigned int)strlen(processname);
+    unsigned int name_hash = 0;
+    HASH_VALUE(processname, name_len, name_hash);
+    HASH_FIND_BYHASHVALUE(hh, g_targets_list, processname, name_len, name_hash, target);
+    return target;
+}
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct run
+{
+    struct target *(*lookup)(struct sim_proc *p);
+    int threads;
+};
+
+static void *
+worker(void *arg)
+{
+    struct run *run = (struct run*)arg;
+    uint64_t found = 0;
+    // a stride through the procs so consecutive lookups don't hit the same cache lines
+    for (uint32_t i = 0, index = 0; i < LOOKUPS / run->threads; i++, index = (index + 769) & (PROCS - 1))
+    {
+        found += (run->lookup(&g_procs[index]) != NULL);
+    }
+    __sync_fetch_and_add(&g_found, found);
+    return NULL;
+}
+
+static double
+run_ns(struct target *(*lookup)(struct sim_proc *p), int threads)
+{
+    pthread_t ids[8];
+    struct run run = { lookup, threads };
+    g_found = 0;
+    double start = now_seconds();
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_create(&ids[i], NULL, worker, &run);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+    }
+    return (now_seconds() - start) * 1e9 / (LOOKUPS / threads * threads);
+}
+
+int
+main(void)
+{
+    for (int i = 0; i < TARGETS; i++)
+    {
+        snprintf(g_targets[i].name, sizeof(g_targets[i].name), "target%d", i);
+        HASH_ADD_KEYPTR(hh, g_targets_list, g_targets[i].name, (int)strlen(g_targets[i].name), &g_targets[i]);
+    }
+    // half of the execs are targets, p_name is only set for some like the kernel does
+    for (int i = 0; i < PROCS; i++)
+    {
+        struct sim_proc *p = &g_procs[i];
+        p->p_pid = 100 + i;
+        pthread_mutex_init(&p->p_mlock, NULL);
+        if (i & 1)
+        {
+            snprintf(p->p_comm, sizeof(p->p_comm), "target%d", i % TARGETS);
+        }
+        else
+        {
+            snprintf(p->p_comm, sizeof(p->p_comm), "daemon%d", i);
+        }
+        if ((i & 3) == 1)
+        {
+            copy_name(p->p_name, p->p_comm, sizeof(p->p_name));
+        }
+        HASH_ADD_INT(g_pid_hash, p_pid, p);
+    }
+    printf("%d targets, %d lookups, half of them hits\n", TARGETS, LOOKUPS);
+    printf("%-8s %26s %30s\n", "threads", "proc_name+FIND_STR ns", "proc copy+FIND_BYHASHVALUE ns");
+    for (int threads = 1; threads <= 4; threads *= 2)
+    {
+        double before = run_ns(lookup_before, threads);
+        uint64_t found_before = g_found;
+        double after = run_ns(lookup_after, threads);
+        if (g_found != found_before)
+        {
+            fprintf(stderr, "the two lookups disagree: %llu != %llu\n", (unsigned long long)found_before, (unsigned long long)g_found);
+            return 1;
+        }
+        printf("%-8d %26.1f %30.1f\n", threads, before, after);
+    }
+    return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * bench_lzss.c
+ *
+ * Decompression speed and memory of lzss.c on a compressed kernelcache given on the command line
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+
+#include "lzss.h"
+
+#define KERNELCACHE_SIGNATURE   0x636f6d70  // 'comp'
+#define KERNELCACHE_LZSS        0x6c7a7373  // 'lzss'
+// same chunk kernelcache.c reads from disk
+#define INPUT_CHUNK             (64 * 1024)
+#define OUTPUT_CHUNK            (64 * 1024)
+
+// the container header, same as kernelcache.c
+struct compressed_kernel_header
+{
+    uint32_t signature;
+    uint32_t compress_type;
+    uint32_t adler32;
+    uint32_t uncompressed_size;
+    uint32_t compressed_size;
+    uint32_t reserved[11];
+    uint8_t  platform_name[64];
+    uint8_t  root_path[256];
+};
+
+struct file_input
+{
+    FILE *file;
+    uint32_t left;                  // compressed bytes not read yet
+};
+
+static int
+read_input(void *context, uint8_t *buffer, uint32_t size)
+{
+    struct file_input *input = (struct file_input*)context;
+    uint32_t len = (input->left < size) ? input->left : size;
+    if (len == 0)
+    {
+        return 0;
+    }
+    if (fread(buffer, 1, len, input->file) != len)
+    {
+        return -1;
+    }
+    input->left -= len;
+    return (int)len;
+}
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * decompress the whole image, either copying it out in chunks or only through the window
+ * like the kext does for everything it doesn't keep
+ */
+static int
+run(const char *path, int skip, double *seconds, uint64_t *size)
+{
+    static struct lzss_stream stream;
+    static uint8_t input_buffer[INPUT_CHUNK];
+    static uint8_t output[OUTPUT_CHUNK];
+    struct compressed_kernel_header header;
+    struct file_input input = { fopen(path, "rb"), 0 };
+    if (input.file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, input.file) != 1 ||
+        ntohl(header.signature) != KERNELCACHE_SIGNATURE || ntohl(header.compress_type) != KERNELCACHE_LZSS)
+    {
+        fprintf(stderr, "%s is not a lzss compressed kernelcache\n", path);
+        fclose(input.file);
+        return -1;
+    }
+    input.left = ntohl(header.compressed_size);
+    *size = ntohl(header.uncompressed_size);
+    double start = now_seconds();
+    lzss_init(&stream, read_input, &input, input_buffer, sizeof(input_buffer));
+    int error = 0;
+    if (skip)
+    {
+        error = lzss_skip(&stream, *size);
+    }
+    else
+    {
+        for (uint64_t done = 0; done < *size && error == 0; done += OUTPUT_CHUNK)
+        {
+            uint64_t len = (*size - done < OUTPUT_CHUNK) ? *size - done : OUTPUT_CHUNK;
+            error = lzss_read(&stream, output, len);
+        }
+    }
+    *seconds = now_seconds() - start;
+    fclose(input.file);
+    if (error)
+    {
+        fprintf(stderr, "%s: compressed data is truncated after %llu bytes\n", path, (unsigned long long)stream.output_pos);
+        return -1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    // make bench runs everything, there's no kernelcache unless one is given
+    if (argc < 2)
+    {
+        printf("bench_lzss: no kernelcache given, skipped (make bench KERNELCACHE=path)\n");
+        return 0;
+    }
+    double read_seconds = 0, skip_seconds = 0;
+    uint64_t size = 0;
+    if (run(argv[1], 0, &read_seconds, &size) || run(argv[1], 1, &skip_seconds, &size))
+    {
+        return 1;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    uint64_t max_rss = usage.ru_maxrss / 1024;
+#else
+    uint64_t max_rss = usage.ru_maxrss;
+#endif
+    printf("%s: %llu bytes uncompressed, decoder state %zu bytes\n", argv[1], (unsigned long long)size,
+           sizeof(struct lzss_stream) + INPUT_CHUNK);
+    printf("%-10s %10s %10s\n", "mode", "ms", "MB/s");
+    printf("%-10s %10.1f %10.1f\n", "lzss_read", read_seconds * 1000, size / read_seconds / 1e6);
+    printf("%-10s %10.1f %10.1f\n", "lzss_skip", skip_seconds * 1000, size / skip_seconds / 1e6);
+    printf("peak rss %llu KB\n", (unsigned long long)max_rss);
+    return 0;
+}
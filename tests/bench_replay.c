@@ -0,0 +1,222 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * The userland daemon to talk to the kernel and process the target apps
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * bench_replay.c
+ *
+ * Replays an event log through the event scheduler with a simulated handler and reports
+ * suspend to resume time per priority class, a synthetic log is recorded first without one
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <mach/mach_time.h>
+
+#include "event_log.h"
+#include "event_scheduler.h"
+#include "latency_histogram.h"
+
+// the simulated handler cost, the patching and resume the daemon does
+#define SERVICE_NS      100000ULL
+#define SYNTHETIC_EVENTS 10000
+#define BURST           16
+
+static struct latency_histogram g_latency[PRIORITY_CLASSES];
+static volatile uint64_t g_deadlines_missed;
+
+// the daemon metrics, only the calls the scheduler makes
+void
+metrics_deadline_missed(void)
+{
+    __sync_fetch_and_add(&g_deadlines_missed, 1);
+}
+
+void
+metrics_worker_busy(uint64_t start, uint64_t end)
+{
+}
+
+static void
+sleep_ns(uint64_t ns)
+{
+    struct timespec ts = { (time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL) };
+    nanosleep(&ts, NULL);
+}
+
+/*
+ * only suspended processes wait for the handler, the rest is bookkeeping
+ */
+static void
+handle_event(struct hydra_event *event, uint64_t receive_timestamp)
+{
+    if (!(event->flags & HYDRA_EVENT_SUSPENDED))
+    {
+        return;
+    }
+    sleep_ns(SERVICE_NS);
+    uint32_t class = (event->priority < PRIORITY_CLASSES) ? event->priority : PRIORITY_NORMAL;
+    latency_histogram_record(&g_latency[class], mach_absolute_time() - receive_timestamp);
+}
+
+/*
+ * what the daemon does with a replayed event when it has workers
+ */
+static void
+replay_event(struct hydra_event *event, uint64_t receive_timestamp)
+{
+    event_scheduler_submit(event, receive_timestamp);
+}
+
+/*
+ * bursts of mixed classes spaced so the workers are about 90% busy, service is what one event really takes
+ */
+static int
+record_synthetic_log(const char *path, int workers, uint64_t service)
+{
+    static const uint32_t mix[10] = {
+        PRIORITY_INTERACTIVE, PRIORITY_NORMAL, PRIORITY_BATCH, PRIORITY_NORMAL, PRIORITY_NORMAL,
+        PRIORITY_BATCH, PRIORITY_NORMAL, PRIORITY_INTERACTIVE, PRIORITY_NORMAL, PRIORITY_BATCH
+    };
+    if (event_log_open(path))
+    {
+        return -1;
+    }
+    uint64_t burst_gap = BURST * service * 10 / 9 / workers;
+    uint64_t receive_timestamp = mach_absolute_time();
+    struct hydra_event event;
+    memset(&event, 0, sizeof(event));
+    for (int i = 0; i < SYNTHETIC_EVENTS; i++)
+    {
+        event.pid = 1000 + i;
+        event.sequence = i;
+        event.priority = mix[i % 10];
+        event.flags = HYDRA_EVENT_SUSPENDED;
+        event.exec_timestamp = receive_timestamp;
+        event.suspend_timestamp = receive_timestamp;
+        event.enqueue_timestamp = receive_timestamp;
+        snprintf(event.name, sizeof(event.name), "target%d", i % 10);
+        event_log_write(&event, receive_timestamp);
+        if (i % BURST == BURST - 1)
+        {
+            receive_timestamp += burst_gap;
+        }
+    }
+    event_log_close();
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *names[PRIORITY_CLASSES] = {
+        [PRIORITY_NORMAL] = "normal", [PRIORITY_INTERACTIVE] = "interactive", [PRIORITY_BATCH] = "batch"
+    };
+    const char *path = (argc > 1) ? argv[1] : NULL;
+    double speed = (argc > 2) ? strtod(argv[2], NULL) : 1.0;
+    int workers = (argc > 3) ? (int)strtol(argv[3], NULL, 0) : 2;
+    char synthetic[] = "/tmp/bench_replay.XXXXXX";
+    if (path == NULL)
+    {
+        int fd = mkstemp(synthetic);
+        if (fd < 0)
+        {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+        // sleeps overshoot, use what one really takes to set the load
+        uint64_t start = mach_absolute_time();
+        for (int i = 0; i < 100; i++)
+        {
+            sleep_ns(SERVICE_NS);
+        }
+        if (record_synthetic_log(synthetic, workers, (mach_absolute_time() - start) / 100))
+        {
+            unlink(synthetic);
+            return 1;
+        }
+        path = synthetic;
+    }
+    if (event_scheduler_start(workers, handle_event))
+    {
+        return 1;
+    }
+    uint64_t start = mach_absolute_time();
+    int count = event_log_replay(path, speed, replay_event);
+    event_scheduler_stop();
+    uint64_t elapsed = mach_absolute_time() - start;
+    if (path == synthetic)
+    {
+        unlink(synthetic);
+    }
+    if (count < 0)
+    {
+        return 1;
+    }
+    printf("%s%d events replayed at %.1fx in %llu ms, %d workers, %llu us handler\n", (path == synthetic) ? "synthetic log, " : "",
+           count, speed, (unsigned long long)elapsed / 1000000, workers, SERVICE_NS / 1000);
+    printf("%-12s %8s %10s %10s %10s\n", "class", "events", "p50 us", "p99 us", "max us");
+    for (int i = 0; i < PRIORITY_CLASSES; i++)
+    {
+        struct latency_histogram *histogram = &g_latency[i];
+        printf("%-12s %8llu %10llu %10llu %10llu\n", names[i], (unsigned long long)histogram->count,
+               (unsigned long long)latency_histogram_percentile(histogram, 500) / 1000,
+               (unsigned long long)latency_histogram_percentile(histogram, 990) / 1000,
+               (unsigned long long)histogram->max / 1000);
+    }
+    printf("deadlines missed: %llu\n", (unsigned long long)g_deadlines_missed);
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * test_event_ring.c
+ *
+ * Several producers and one consumer hammering event_ring.h, plus a ring the other side corrupted
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "event_ring.h"
+#include "test.h"
+
+#define RING_SIZE           EVENT_RING_MIN_SIZE
+#define PRODUCERS           4
+#define EVENTS_PER_PRODUCER 200000
+
+static struct event_ring g_ring;
+
+static void *
+producer(void *arg)
+{
+    uint32_t id = (uint32_t)(uintptr_t)arg;
+    struct hydra_event event;
+    memset(&event, 0, sizeof(event));
+    event.pid = id;
+    for (uint32_t i = 0; i < EVENTS_PER_PRODUCER; i++)
+    {
+        event.sequence = i;
+        // the kext would fall back to the socket, here we wait for room
+        while (event_ring_produce(&g_ring, &event) < 0)
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/*
+ * every event arrives once and each producer's events keep their order
+ */
+static void
+test_producers(void)
+{
+    void *memory = NULL;
+    posix_memalign(&memory, 4096, RING_SIZE);
+    CHECK(event_ring_attach(&g_ring, memory, RING_SIZE, 1) == 0);
+    pthread_t threads[PRODUCERS];
+    for (uintptr_t i = 0; i < PRODUCERS; i++)
+    {
+        pthread_create(&threads[i], NULL, producer, (void*)i);
+    }
+    uint32_t next[PRODUCERS] = { 0 };
+    uint64_t received = 0;
+    int out_of_order = 0;
+    struct hydra_event event;
+    while (received < (uint64_t)PRODUCERS * EVENTS_PER_PRODUCER)
+    {
+        if (!event_ring_consume(&g_ring, &event))
+        {
+            sched_yield();
+            continue;
+        }
+        if (event.pid >= PRODUCERS || event.sequence != next[event.pid])
+        {
+            out_of_order++;
+            continue;
+        }
+        next[event.pid]++;
+        received++;
+    }
+    for (int i = 0; i < PRODUCERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        CHECK_EQ(next[i], EVENTS_PER_PRODUCER);
+    }
+    CHECK_EQ(out_of_order, 0);
+    CHECK_EQ(event_ring_consume(&g_ring, &event), 0);
+    CHECK_EQ(event_ring_depth(&g_ring), 0);
+    free(memory);
+}
+
+/*
+ * the doorbell is only needed when the consumer may be asleep on an empty ring
+ */
+static void
+test_doorbell(void)
+{
+    struct event_ring ring;
+    void *memory = NULL;
+    posix_memalign(&memory, 4096, RING_SIZE);
+    CHECK(event_ring_attach(&ring, memory, RING_SIZE, 1) == 0);
+    struct hydra_event event;
+    memset(&event, 0, sizeof(event));
+    CHECK_EQ(event_ring_produce(&ring, &event), 1);
+    CHECK_EQ(event_ring_produce(&ring, &event), 0);
+    CHECK_EQ(event_ring_depth(&ring), 2);
+    CHECK_EQ(event_ring_consume(&ring, &event), 1);
+    CHECK_EQ(event_ring_consume(&ring, &event), 1);
+    CHECK_EQ(event_ring_produce(&ring, &event), 1);
+    // full ring
+    uint64_t capacity = ring.mask + 1;
+    for (uint64_t i = 1; i < capacity; i++)
+    {
+        CHECK(event_ring_produce(&ring, &event) >= 0);
+    }
+    CHECK_EQ(event_ring_produce(&ring, &event), -1);
+    free(memory);
+}
+
+/*
+ * the daemon owns the memory, whatever it writes there the producer must come back
+ */
+static void
+test_corrupted(void)
+{
+    struct event_ring ring;
+    void *memory = NULL;
+    posix_memalign(&memory, 4096, RING_SIZE);
+    CHECK(event_ring_attach(&ring, memory, RING_SIZE, 1) == 0);
+    struct hydra_event event;
+    memset(&event, 0, sizeof(event));
+    // every slot looks taken by a producer further ahead, the old loop never left this
+    for (uint64_t i = 0; i <= ring.mask; i++)
+    {
+        ring.slots[i].sequence = UINT64_MAX / 2;
+    }
+    CHECK_EQ(event_ring_produce(&ring, &event), -1);
+    // and a head far from anything the slots say
+    ring.header->head = 12345678;
+    CHECK_EQ(event_ring_produce(&ring, &event), -1);
+    CHECK(event_ring_depth(&ring) <= ring.mask + 1);
+    free(memory);
+}
+
+int
+main(void)
+{
+    test_doorbell();
+    test_corrupted();
+    test_producers();
+    return test_result("event_ring");
+}
@@ -0,0 +1,133 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * test_latency_histogram.c
+ *
+ * Bucket boundaries and percentiles of latency_histogram.h
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "latency_histogram.h"
+#include "test.h"
+
+static void
+test_buckets(void)
+{
+    CHECK_EQ(latency_histogram_bucket(0), 0);
+    CHECK_EQ(latency_histogram_bucket(1), 1);
+    CHECK_EQ(latency_histogram_bucket(2), 2);
+    CHECK_EQ(latency_histogram_bucket(3), 2);
+    CHECK_EQ(latency_histogram_bucket(4), 3);
+    CHECK_EQ(latency_histogram_bucket(1023), 10);
+    CHECK_EQ(latency_histogram_bucket(1024), 11);
+    // bucket i holds [2^(i-1), 2^i)
+    for (uint32_t i = 1; i < LATENCY_HISTOGRAM_BUCKETS - 1; i++)
+    {
+        CHECK_EQ(latency_histogram_bucket(1ULL << (i - 1)), i);
+        CHECK_EQ(latency_histogram_bucket((1ULL << i) - 1), i);
+    }
+    // everything too big ends in the last one
+    CHECK_EQ(latency_histogram_bucket(1ULL << (LATENCY_HISTOGRAM_BUCKETS - 1)), LATENCY_HISTOGRAM_BUCKETS - 1);
+    CHECK_EQ(latency_histogram_bucket(UINT64_MAX), LATENCY_HISTOGRAM_BUCKETS - 1);
+}
+
+static void
+test_percentiles(void)
+{
+    struct latency_histogram histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    CHECK_EQ(latency_histogram_percentile(&histogram, 500), 0);
+    
+    // 99 fast samples and a slow one
+    for (int i = 0; i < 99; i++)
+    {
+        latency_histogram_record(&histogram, 100);
+    }
+    latency_histogram_record(&histogram, 5000);
+    CHECK_EQ(histogram.count, 100);
+    CHECK_EQ(histogram.max, 5000);
+    // upper bound of [64, 128)
+    CHECK_EQ(latency_histogram_percentile(&histogram, 500), 127);
+    CHECK_EQ(latency_histogram_percentile(&histogram, 990), 127);
+    // the slow one is past the rank of p99, its bucket bound 8191 is capped at the max
+    CHECK_EQ(latency_histogram_percentile(&histogram, 1000), 5000);
+    
+    // a single sample never reports more than itself
+    memset(&histogram, 0, sizeof(histogram));
+    latency_histogram_record(&histogram, 5);
+    CHECK_EQ(latency_histogram_percentile(&histogram, 500), 5);
+    CHECK_EQ(latency_histogram_percentile(&histogram, 0), 5);
+    
+    // zeroes have their own bucket
+    memset(&histogram, 0, sizeof(histogram));
+    latency_histogram_record(&histogram, 0);
+    latency_histogram_record(&histogram, 0);
+    latency_histogram_record(&histogram, 3);
+    CHECK_EQ(latency_histogram_percentile(&histogram, 500), 0);
+    CHECK_EQ(latency_histogram_percentile(&histogram, 990), 3);
+    
+    // the last bucket has no upper bound, the max is the answer
+    memset(&histogram, 0, sizeof(histogram));
+    latency_histogram_record(&histogram, 1ULL << 50);
+    CHECK_EQ(latency_histogram_percentile(&histogram, 500), 1ULL << 50);
+}
+
+int
+main(void)
+{
+    test_buckets();
+    test_percentiles();
+    return test_result("latency_histogram");
+}
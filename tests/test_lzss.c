@@ -0,0 +1,182 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * test_lzss.c
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "lzss.h"
+#include "test.h"
+
+// the text below compressed the way the kernelcache is, checked against a separate decoder
+// it starts with a match into the initial window of spaces and has overlapping matches
+static const uint8_t g_compressed[] = {
+    0xfe, 0x00, 0x01, 0x68, 0x79, 0x64, 0x72, 0x61, 0x20, 0x73, 0x7f, 0x75,
+    0x73, 0x70, 0x65, 0x6e, 0x64, 0x73, 0xf1, 0xf4, 0xff, 0x74, 0x61, 0x72,
+    0x67, 0x65, 0x74, 0x73, 0x2c, 0x7e, 0x00, 0x04, 0x72, 0x65, 0x73, 0x75,
+    0x6d, 0x65, 0xff, 0xfc, 0xc7, 0x2e, 0x20, 0x61, 0x2d, 0x0f, 0x2d, 0x0f,
+    0x2d, 0x00, 0x20, 0x30, 0xff, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+    0x38, 0x05, 0x39, 0x55, 0x08, 0x0a,
+};
+
+static const char g_text[] = "    hydra suspends hydra targets, hydra resumes hydra targets. "
+                             "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa 0123456789 0123456789\n";
+
+#define TEXT_LEN    (sizeof(g_text) - 1)
+
+struct test_input
+{
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t pos;
+    uint32_t max_read;              // the most returned by one call
+    int fail;                       // return an error instead of the end of the data
+};
+
+static int
+read_input(void *context, uint8_t *buffer, uint32_t size)
+{
+    struct test_input *input = (struct test_input*)context;
+    uint32_t len = input->len - input->pos;
+    if (len == 0)
+    {
+        return input->fail ? -1 : 0;
+    }
+    if (len > size)
+    {
+        len = size;
+    }
+    if (len > input->max_read)
+    {
+        len = input->max_read;
+    }
+    memcpy(buffer, input->data + input->pos, len);
+    input->pos += len;
+    return (int)len;
+}
+
+static void
+test_whole(void)
+{
+    static struct lzss_stream stream;
+    struct test_input input = { g_compressed, sizeof(g_compressed), 0, sizeof(g_compressed), 0 };
+    uint8_t buffer[64];
+    char output[TEXT_LEN];
+    lzss_init(&stream, read_input, &input, buffer, sizeof(buffer));
+    CHECK_EQ(lzss_read(&stream, output, TEXT_LEN), 0);
+    CHECK(memcmp(output, g_text, TEXT_LEN) == 0);
+    CHECK_EQ(stream.output_pos, TEXT_LEN);
+    CHECK_EQ(input.pos, sizeof(g_compressed));
+}
+
+/*
+ * items cut by the end of the input and matches cut by the end of a read must come out the same
+ */
+static void
+test_streaming(void)
+{
+    static struct lzss_stream stream;
+    struct test_input input = { g_compressed, sizeof(g_compressed), 0, 1, 0 };
+    uint8_t buffer[1];
+    char output[TEXT_LEN];
+    lzss_init(&stream, read_input, &input, buffer, sizeof(buffer));
+    for (size_t done = 0; done < TEXT_LEN; done += 7)
+    {
+        size_t len = (TEXT_LEN - done < 7) ? TEXT_LEN - done : 7;
+        CHECK_EQ(lzss_read(&stream, output + done, len), 0);
+    }
+    CHECK(memcmp(output, g_text, TEXT_LEN) == 0);
+}
+
+static void
+test_skip(void)
+{
+    static struct lzss_stream stream;
+    struct test_input input = { g_compressed, sizeof(g_compressed), 0, 5, 0 };
+    uint8_t buffer[16];
+    char output[TEXT_LEN];
+    lzss_init(&stream, read_input, &input, buffer, sizeof(buffer));
+    // lands in the middle of the run of a
+    CHECK_EQ(lzss_skip(&stream, 70), 0);
+    CHECK_EQ(lzss_read(&stream, output, TEXT_LEN - 70), 0);
+    CHECK(memcmp(output, g_text + 70, TEXT_LEN - 70) == 0);
+}
+
+static void
+test_truncated(void)
+{
+    static struct lzss_stream stream;
+    uint8_t buffer[16];
+    char output[TEXT_LEN];
+    // the input ends before the text does
+    struct test_input input = { g_compressed, sizeof(g_compressed) - 3, 0, sizeof(g_compressed), 0 };
+    lzss_init(&stream, read_input, &input, buffer, sizeof(buffer));
+    CHECK_EQ(lzss_read(&stream, output, TEXT_LEN), -1);
+    CHECK(stream.output_pos < TEXT_LEN);
+    // and the input callback fails
+    struct test_input failing = { g_compressed, 10, 0, sizeof(g_compressed), 1 };
+    lzss_init(&stream, read_input, &failing, buffer, sizeof(buffer));
+    CHECK_EQ(lzss_skip(&stream, TEXT_LEN), -1);
+}
+
+int
+main(void)
+{
+    test_whole();
+    test_streaming();
+    test_skip();
+    test_truncated();
+    return test_result("lzss");
+}
@@ -0,0 +1,177 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * test_slab.c
+ *
+ * Allocation, exhaustion and reset of the slab.c pools
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "slab.h"
+#include "test.h"
+
+// slab.c is built with this as its backend, see test_slab_backend.h
+static int g_fail_allocations = 0;
+
+void *
+test_slab_alloc(size_t size)
+{
+    return g_fail_allocations ? NULL : calloc(1, size);
+}
+
+struct object
+{
+    uint64_t a;
+    char b[20];
+};
+
+static void
+test_alloc_free(void)
+{
+    struct slab_pool pool;
+    slab_pool_init(&pool, sizeof(struct object), 4);
+    CHECK_EQ(pool.object_size % 16, 0);
+    struct object *objects[4];
+    for (int i = 0; i < 4; i++)
+    {
+        objects[i] = slab_alloc(&pool);
+        CHECK(objects[i] != NULL);
+        CHECK_EQ((uintptr_t)objects[i] % 16, 0);
+        memset(objects[i], 0xff, sizeof(struct object));
+    }
+    CHECK_EQ(pool.stats.slabs, 1);
+    CHECK_EQ(pool.stats.in_use, 4);
+    // freed objects come back zeroed
+    slab_free(&pool, objects[2]);
+    struct object *again = slab_alloc(&pool);
+    CHECK(again == objects[2]);
+    CHECK_EQ(again->a, 0);
+    CHECK_EQ(pool.stats.slabs, 1);
+    slab_free(&pool, NULL);
+    CHECK_EQ(pool.stats.in_use, 4);
+    slab_pool_destroy(&pool);
+}
+
+static void
+test_exhaustion(void)
+{
+    struct slab_pool pool;
+    slab_pool_init(&pool, sizeof(struct object), 4);
+    for (int i = 0; i < 4; i++)
+    {
+        slab_alloc(&pool);
+    }
+    // a full slab needs a new one
+    CHECK(slab_alloc(&pool) != NULL);
+    CHECK_EQ(pool.stats.slabs, 2);
+    for (int i = 0; i < 3; i++)
+    {
+        slab_alloc(&pool);
+    }
+    CHECK_EQ(pool.stats.in_use, 8);
+    // and when there's no memory for it the allocation fails and is counted
+    g_fail_allocations = 1;
+    CHECK(slab_alloc(&pool) == NULL);
+    CHECK_EQ(pool.stats.failures, 1);
+    CHECK_EQ(pool.stats.slabs, 2);
+    CHECK_EQ(pool.stats.in_use, 8);
+    CHECK_EQ(pool.stats.max_in_use, 8);
+    g_fail_allocations = 0;
+    slab_pool_destroy(&pool);
+}
+
+static void
+test_reset(void)
+{
+    struct slab_pool pool;
+    slab_pool_init(&pool, sizeof(struct object), 4);
+    void *first[8];
+    for (int i = 0; i < 8; i++)
+    {
+        first[i] = slab_alloc(&pool);
+    }
+    slab_pool_reset(&pool);
+    CHECK_EQ(pool.stats.in_use, 0);
+    CHECK_EQ(pool.stats.slabs, 2);
+    // the slabs are kept, the same objects are handed out again without allocating
+    g_fail_allocations = 1;
+    for (int i = 0; i < 8; i++)
+    {
+        void *object = slab_alloc(&pool);
+        CHECK(object != NULL);
+        int found = 0;
+        for (int j = 0; j < 8; j++)
+        {
+            found |= (object == first[j]);
+        }
+        CHECK(found);
+    }
+    CHECK(slab_alloc(&pool) == NULL);
+    g_fail_allocations = 0;
+    CHECK_EQ(pool.stats.max_in_use, 8);
+    slab_pool_destroy(&pool);
+    CHECK_EQ(pool.stats.slabs, 0);
+    CHECK(pool.free_list == NULL);
+}
+
+int
+main(void)
+{
+    test_alloc_free();
+    test_exhaustion();
+    test_reset();
+    return test_result("slab");
+}
@@ -0,0 +1,129 @@
+/*
+ *
+ *                                                        dddddddd
+ * HHHHHHHHH     HHHHHHHHH                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * H:::::::H     H:::::::H                                d::::::d
+ * HH::::::H     H::::::HH                                d:::::d
+ *   H:::::H     H:::::Hyyyyyyy           yyyyyyy ddddddddd:::::drrrrr   rrrrrrrrr   aaaaaaaaaaaaa
+ *   H:::::H     H:::::H y:::::y         y:::::ydd::::::::::::::dr::::rrr:::::::::r  a::::::::::::a
+ *   H::::::HHHHH::::::H  y:::::y       y:::::yd::::::::::::::::dr:::::::::::::::::r aaaaaaaaa:::::a
+ *   H:::::::::::::::::H   y:::::y     y:::::yd:::::::ddddd:::::drr::::::rrrrr::::::r         a::::a
+ *   H:::::::::::::::::H    y:::::y   y:::::y d::::::d    d:::::d r:::::r     r:::::r  aaaaaaa:::::a
+ *   H::::::HHHHH::::::H     y:::::y y:::::y  d:::::d     d:::::d r:::::r     rrrrrrraa::::::::::::a
+ *   H:::::H     H:::::H      y:::::y:::::y   d:::::d     d:::::d r:::::r           a::::aaaa::::::a
+ *   H:::::H     H:::::H       y:::::::::y    d:::::d     d:::::d r:::::r          a::::a    a:::::a
+ * HH::::::H     H::::::HH      y:::::::y     d::::::ddddd::::::ddr:::::r          a::::a    a:::::a
+ * H:::::::H     H:::::::H       y:::::y       d:::::::::::::::::dr:::::r          a:::::aaaa::::::a
+ * H:::::::H     H:::::::H      y:::::y         d:::::::::ddd::::dr:::::r           a::::::::::aa:::a
+ * HHHHHHHHH     HHHHHHHHH     y:::::y           ddddddddd   dddddrrrrrrr            aaaaaaaaaa  aaaa
+ *                            y:::::y
+ *                           y:::::y
+ *                          y:::::y
+ *                         y:::::y
+ *                        yyyyyyy
+ *
+ * A kernel extension to suspend applications and notify a userland daemon
+ *
+ * Copyright (c) 2012,2013 fG!. All rights reserved.
+ * reverser@put.as - http://reverse.put.as
+ *
+ * test_token_bucket.c
+ *
+ * Burst and refill of the token_bucket.h GCRA
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdint.h>
+
+#include "token_bucket.h"
+#include "test.h"
+
+static void
+test_burst(void)
+{
+    struct token_bucket bucket;
+    token_bucket_init(&bucket, 10, 3);
+    uint64_t now = 1000;
+    // a new bucket is full
+    CHECK_EQ(token_bucket_take(&bucket, now), 1);
+    CHECK_EQ(token_bucket_take(&bucket, now), 1);
+    CHECK_EQ(token_bucket_take(&bucket, now), 1);
+    CHECK_EQ(token_bucket_take(&bucket, now), 0);
+    CHECK_EQ(token_bucket_take(&bucket, now), 0);
+    // refused takes don't move it
+    CHECK_EQ(bucket.full_at, now + 30);
+}
+
+static void
+test_refill(void)
+{
+    struct token_bucket bucket;
+    token_bucket_init(&bucket, 10, 3);
+    uint64_t now = 1000;
+    for (int i = 0; i < 3; i++)
+    {
+        token_bucket_take(&bucket, now);
+    }
+    // one token per interval
+    CHECK_EQ(token_bucket_take(&bucket, now + 9), 0);
+    CHECK_EQ(token_bucket_take(&bucket, now + 10), 1);
+    CHECK_EQ(token_bucket_take(&bucket, now + 10), 0);
+    CHECK_EQ(token_bucket_take(&bucket, now + 25), 1);
+    CHECK_EQ(token_bucket_take(&bucket, now + 25), 0);
+    // a long idle time only refills up to the burst
+    now += 100000;
+    int taken = 0;
+    while (token_bucket_take(&bucket, now))
+    {
+        taken++;
+    }
+    CHECK_EQ(taken, 3);
+}
+
+static void
+test_rate(void)
+{
+    struct token_bucket bucket;
+    // burst 0 is a burst of 1
+    token_bucket_init(&bucket, 7, 0);
+    CHECK_EQ(bucket.depth, 7);
+    int taken = 0;
+    // one attempt per tick during 700 ticks gets the rate plus the initial token
+    for (uint64_t now = 1; now <= 700; now++)
+    {
+        taken += token_bucket_take(&bucket, now);
+    }
+    CHECK_EQ(taken, 100);
+}
+
+int
+main(void)
+{
+    test_burst();
+    test_refill();
+    test_rate();
+    return test_result("token_bucket");
+}